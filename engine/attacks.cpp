@@ -0,0 +1,176 @@
+#include "attacks.h"
+
+namespace Medusa
+{
+	// Magic numbers for the rook attack tables, found by trial of sparse
+	// random numbers which map every relevant occupancy to a unique index.
+	static const uint64_t rook_magic_numbers[64] = {
+		0x0280088051A0C000ULL, 0x0040001000200042ULL, 0x02002080400A0010ULL,
+		0x6500100088042100ULL, 0x0100020800041100ULL, 0x2200020005449018ULL,
+		0xA080010000800200ULL, 0xCA0001840C420123ULL, 0x0300802040008000ULL,
+		0x0010804000802000ULL, 0x2021802001100082ULL, 0x0020801000840802ULL,
+		0x2201000500120800ULL, 0x100300080B000400ULL, 0x3806800600170080ULL,
+		0x8002000100820044ULL, 0x8000818000400020ULL, 0x0208810030400100ULL,
+		0x4000888020021000ULL, 0x1800090020100100ULL, 0x0040050011000800ULL,
+		0x0249010002040008ULL, 0x1000440010080102ULL, 0x400206000508A844ULL,
+		0x0010800280244000ULL, 0x0108200440005000ULL, 0x000901C100142004ULL,
+		0x0010880280100080ULL, 0x0216080080040080ULL, 0x9002020080040080ULL,
+		0x0002000200040801ULL, 0x0212005200140081ULL, 0x6680614002800186ULL,
+		0x4220004000802080ULL, 0x0100110041002001ULL, 0x44C0801002800801ULL,
+		0x0865000801000410ULL, 0x0002000400800280ULL, 0x0000821004002841ULL,
+		0x0000800040800100ULL, 0x0240800040008020ULL, 0x4010420900820021ULL,
+		0x0020010220490010ULL, 0xA008008010028008ULL, 0x80220004508A0020ULL,
+		0x2000020004008080ULL, 0x9C00010802040010ULL, 0x04010000A0410012ULL,
+		0x84008000C300E500ULL, 0x0042004020810200ULL, 0x0020001000882080ULL,
+		0x8005100080480180ULL, 0x0818040080080080ULL, 0x2004010040020040ULL,
+		0x0000080250010400ULL, 0x002008440118A200ULL, 0x1006028111006042ULL,
+		0x0040204000810011ULL, 0x0300100A00204082ULL, 0x4042000410200842ULL,
+		0x2002000820041002ULL, 0x0812004804011082ULL, 0xA6005001120800A4ULL,
+		0x04081900840022C2ULL };
+
+	// Magic numbers for the bishop attack tables.
+	static const uint64_t bishop_magic_numbers[64] = {
+		0x0010024204002201ULL, 0x0004448444019841ULL, 0x0008024400209042ULL,
+		0x00220A0208110420ULL, 0x1008484012061020ULL, 0x91C104200400001CULL,
+		0x0020441004111618ULL, 0x0621208804112002ULL, 0x000004A142041102ULL,
+		0x8000101000A10040ULL, 0x0800420086008801ULL, 0x0000240401970000ULL,
+		0x0010A42420041000ULL, 0x820020921040000CULL, 0x0021820110029001ULL,
+		0x2010103401041000ULL, 0xC020200504440800ULL, 0x4404811050008100ULL,
+		0x0510020200320020ULL, 0x000409880C109020ULL, 0x024401821120040CULL,
+		0x0041000190080120ULL, 0x200C030904018402ULL, 0x0020530100480400ULL,
+		0x4620132844100202ULL, 0x1C1002400808C100ULL, 0x2604300002040040ULL,
+		0x0004004004010002ULL, 0x0101001011004010ULL, 0x0030040818410801ULL,
+		0x0100B08904040401ULL, 0x0841002409008801ULL, 0x000804044E112050ULL,
+		0x4018010800108208ULL, 0x8100140202100088ULL, 0x0006020080080080ULL,
+		0x8060008400088021ULL, 0x18100220200A0084ULL, 0x28900101004200A0ULL,
+		0x00041C008022228CULL, 0x0008380288041000ULL, 0x0300823010108200ULL,
+		0x300A020822000400ULL, 0x1020002214084800ULL, 0x3000408810401202ULL,
+		0x2040013204080080ULL, 0x2044100408600102ULL, 0x0030110D20240100ULL,
+		0x0184044402080080ULL, 0x0080848818021000ULL, 0x8004002201102088ULL,
+		0x1E011000420202C0ULL, 0x0049200910240030ULL, 0x0430101410043002ULL,
+		0x0804610802008000ULL, 0x0084041084010880ULL, 0x280A048C84012001ULL,
+		0x0100102108021004ULL, 0x00B1008092481811ULL, 0x0081000811040910ULL,
+		0x0200080830520884ULL, 0x000400C011020084ULL, 0x00304204040C2840ULL,
+		0x100410A401040010ULL };
+
+	// Attack tables, each square has 2^(relevant occupants) entries.
+	static Bitboard rook_table[0x19000];
+	static Bitboard bishop_table[0x1480];
+	static Bitboard rook_pext_table[0x19000];
+	static Bitboard bishop_pext_table[0x1480];
+
+	Magic rook_magics[64];
+	Magic bishop_magics[64];
+	Bitboard squares_between[64][64];
+	Bitboard squares_line[64][64];
+	Bitboard pawn_attack_table[2][64];
+
+	// Squares whose occupancy affects the attacks of a slider, the last
+	// square of each ray is never relevant since it is attacked either way.
+	Bitboard RelevantOccupants(Square sqr, const std::pair<int, int> *directions)
+	{
+		int rank = sqr / 8;
+		int file = sqr % 8;
+		Bitboard edges = ((ranks[0] | ranks[7]) & ~ranks[rank]) |
+			((files[0] | files[7]) & ~files[file]);
+		return DirectionAttacks(Bitboard(0), sqr, directions) & ~edges;
+	}
+
+	// Fill the attack table of every square for one slider, the attacks
+	// are calculated by walking the rays for each subset of the mask.
+	void InitMagics(
+		Magic *magics,
+		const uint64_t *magic_numbers,
+		Bitboard *table,
+		Bitboard *pext_table,
+		const std::pair<int, int> *directions)
+	{
+		Bitboard *attacks = table;
+		Bitboard *pext_attacks = pext_table;
+		for (int s = 0; s < 64; s++)
+		{
+			Square sqr = Square(s);
+			Magic& m = magics[sqr];
+			m.mask = RelevantOccupants(sqr, directions);
+			m.magic = magic_numbers[sqr];
+			m.shift = 64 - m.mask.PopCnt();
+			m.attacks = attacks;
+			m.pext_attacks = pext_attacks;
+
+			// Carry-Rippler trick to enumerate all subsets of the mask. The
+			// subsets come out in order of their extracted bits, so the PEXT
+			// index is just the count so far and needs no BMI2 to fill.
+			Bitboard subset(0);
+			size_t count = 0;
+			do
+			{
+				auto attack = DirectionAttacks(subset, sqr, directions);
+				m.attacks[m.Index(subset)] = attack;
+				m.pext_attacks[count++] = attack;
+				subset = Bitboard(subset.Number() - m.mask.Number()) & m.mask;
+			} while (subset);
+
+			attacks += count;
+			pext_attacks += count;
+		}
+	}
+
+	// Geometry tables for pins and checks, needs the slider attacks.
+	void InitLines()
+	{
+		for (int a = 0; a < 64; a++)
+		{
+			Square sa = Square(a);
+			for (int b = 0; b < 64; b++)
+			{
+				Square sb = Square(b);
+				Bitboard ends = squares[a] | squares[b];
+				if (RookAttacks(sa, 0) & squares[b])
+				{
+					squares_line[a][b] = (RookAttacks(sa, 0) & RookAttacks(sb, 0)) | ends;
+					squares_between[a][b] = RookAttacks(sa, squares[b]) & RookAttacks(sb, squares[a]);
+				}
+				if (BishopAttacks(sa, 0) & squares[b])
+				{
+					squares_line[a][b] = (BishopAttacks(sa, 0) & BishopAttacks(sb, 0)) | ends;
+					squares_between[a][b] = BishopAttacks(sa, squares[b]) & BishopAttacks(sb, squares[a]);
+				}
+			}
+		}
+	}
+
+	// Pawn captures for both colours.
+	void InitPawnAttacks()
+	{
+		for (int s = 0; s < 64; s++)
+		{
+			Bitboard bb = squares[s];
+			pawn_attack_table[0][s] = ((bb << 7) & ~files[7]) | ((bb << 9) & ~files[0]);
+			pawn_attack_table[1][s] = ((bb >> 9) & ~files[7]) | ((bb >> 7) & ~files[0]);
+		}
+	}
+
+	bool CpuHasBmi2()
+	{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 8)) != 0;
+#elif defined(__x86_64__) || defined(__i386__)
+		return __builtin_cpu_supports("bmi2");
+#else
+		return false;
+#endif
+	}
+
+	void InitAttacks()
+	{
+		InitMagics(rook_magics, rook_magic_numbers, rook_table, rook_pext_table, rook_directions);
+		InitMagics(bishop_magics, bishop_magic_numbers, bishop_table, bishop_pext_table, bishop_directions);
+		InitLines();
+		InitPawnAttacks();
+	}
+}
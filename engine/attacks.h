@@ -0,0 +1,141 @@
+#ifndef attacks_h
+#define attacks_h
+
+#include <stdint.h>
+
+#include "bitboard.h"
+#include "board.h"
+
+// PEXT needs BMI2, so it is used when the engine is built for it: with
+// /arch:AVX2 for MSVC on x64 (the CPUs with AVX2 have BMI2 as well), or
+// with -mbmi2 or an -march which has it for GCC and Clang. The lookups
+// are then inlined just like the magics, which are the portable build.
+#if defined(__BMI2__) || (defined(_MSC_VER) && defined(_M_X64) && defined(__AVX2__))
+#define USE_PEXT
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(USE_PEXT)
+#include <immintrin.h>
+#endif
+
+namespace Medusa
+{
+	// Ways of indexing the slider attack tables.
+	enum SliderBackend
+	{
+		MAGIC = 0,
+		PEXT = 1,
+	};
+
+	// The backend this build uses.
+#ifdef USE_PEXT
+	const SliderBackend slider_backend = PEXT;
+#else
+	const SliderBackend slider_backend = MAGIC;
+#endif
+
+	// Attack lookup for a single square. For magics the relevant occupants 
+	// are masked, multiplied by the magic number and shifted down to give an
+	// index into the attack table of that square. With BMI2 the relevant
+	// occupants are extracted directly (PEXT) to index a second table.
+	struct Magic
+	{
+		Bitboard mask;
+		uint64_t magic;
+		Bitboard* attacks;
+		Bitboard* pext_attacks;
+		unsigned int shift;
+
+		unsigned int Index(Bitboard occupants) const
+		{
+			return static_cast<unsigned int>(((occupants & mask).Number() * magic) >> shift);
+		}
+
+		Bitboard MagicAttacks(Bitboard occupants) const
+		{
+			return attacks[Index(occupants)];
+		}
+
+#ifdef USE_PEXT
+		Bitboard PextAttacks(Bitboard occupants) const
+		{
+			return pext_attacks[_pext_u64(occupants.Number(), mask.Number())];
+		}
+#endif
+
+		// By the backend of this build.
+		Bitboard Attacks(Bitboard occupants) const
+		{
+#ifdef USE_PEXT
+			return PextAttacks(occupants);
+#else
+			return MagicAttacks(occupants);
+#endif
+		}
+	};
+
+	extern Magic rook_magics[64];
+	extern Magic bishop_magics[64];
+	extern Bitboard squares_between[64][64];
+	extern Bitboard squares_line[64][64];
+	extern Bitboard pawn_attack_table[2][64];
+
+	// Fill the slider attack tables, must be called once on start up.
+	void InitAttacks();
+
+	// Does the CPU support BMI2 (and so PEXT)?
+	bool CpuHasBmi2();
+
+	// Rook attacks from a square given the occupants of the board.
+	inline Bitboard RookAttacks(Square sqr, Bitboard occupants)
+	{
+		return rook_magics[sqr].Attacks(occupants);
+	}
+
+	// Bishop attacks from a square given the occupants of the board.
+	inline Bitboard BishopAttacks(Square sqr, Bitboard occupants)
+	{
+		return bishop_magics[sqr].Attacks(occupants);
+	}
+
+	// Queen attacks from a square given the occupants of the board.
+	inline Bitboard QueenAttacks(Square sqr, Bitboard occupants)
+	{
+		return RookAttacks(sqr, occupants) | BishopAttacks(sqr, occupants);
+	}
+
+	// Squares strictly between two squares on a rank, file or diagonal.
+	inline Bitboard Between(Square a, Square b)
+	{
+		return squares_between[a][b];
+	}
+
+	// The whole rank, file or diagonal through two squares (empty if none).
+	inline Bitboard Line(Square a, Square b)
+	{
+		return squares_line[a][b];
+	}
+
+	// Squares attacked by a pawn of the given colour.
+	inline Bitboard PawnAttacks(Colour colour, Square sqr)
+	{
+		return pawn_attack_table[colour.Index()][sqr];
+	}
+
+	// Slider attacks by piece type, for the move generation templates.
+	template <Piece piece>
+	inline Bitboard SliderAttacks(Square sqr, Bitboard occupants)
+	{
+		static_assert(piece == BISHOP || piece == ROOK || piece == QUEEN,
+			"Only bishops, rooks and queens are sliders.");
+		if (piece == BISHOP)
+			return BishopAttacks(sqr, occupants);
+		if (piece == ROOK)
+			return RookAttacks(sqr, occupants);
+		return QueenAttacks(sqr, occupants);
+	}
+};
+
+#endif
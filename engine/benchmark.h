@@ -1,10 +1,14 @@
 #ifndef benchmark_h
 #define benchmark_h
 
+#include <chrono>
+#include <functional>
+
 #include "evaluation.h"
 #include "utils.h"
 #include "position.h"
 #include "search.h"
+#include "perft.h"
 
 namespace Medusa
 {
@@ -14,9 +18,9 @@ namespace Medusa
 	{
 		auto pos = PositionFromFen("r2q3r/pp1nbkpp/2p1b3/5p2/P2Pp3/1PR5/1BP1BPPP/1N1Q1K1R b - d3 0 19");
 		pos = PositionFromFen("2rqk2r/1bnp1p2/1p3np1/p1pPp2p/2P1P3/P1PBBP2/4N1PP/1R1Q1RK1 w k e6 0 14");
-		std::vector<Move> *moves(new std::vector<Move>());
-		pos.LegalPawnMoves<Any>(pos.ToMove(), moves);
-		for (auto m : *moves)
+		MoveList moves;
+		pos.LegalPawnMoves<Any>(pos.ToMove(), pos.GetLegalityMasks(), &moves);
+		for (auto m : moves)
 		{
 			std::cout << m << ": " << AsUci(m) << std::endl;
 		}
@@ -89,8 +93,8 @@ namespace Medusa
 		/*
 		
 		pos.Apply(move);
-		MoveSelector ms(pos, true);
-		auto moves = ms.GetMoves(); // Does find Qxc2
+		MoveSelector ms(pos, 0, nullptr, nullptr, true);
+		auto move = ms.Next(); // Does find Qxc2
 		pos.Unapply(move);
 		pos.PrettyPrint();
 		*/	   
@@ -102,7 +106,8 @@ namespace Medusa
 		auto score = srch.QSearch(pos, alpha, beta, moves_after, 0);
 		
 		auto move = CreateMove(b4, c2); // Nxc2?
-		pos.Apply(move);
+		PositionHistory history;
+		pos.Apply(move, history);
 		auto score1 = srch.QSearch(pos, alpha, beta, moves_after, 0);
 	}
 
@@ -116,7 +121,7 @@ namespace Medusa
 	void test_legal_moves()
 	{
 		auto pos = PositionFromFen("");
-		pos.PseudoLegalMoves<Any>();
+		pos.LegalMoves<Any>();
 	}
 
 	void test_infinite_score()
@@ -138,9 +143,9 @@ namespace Medusa
 		// Bug: "5k1r/1Rp1r3/2n1pp2/2Pp4/p4P1p/b3BRPB/P1P4P/6K1 b - - 3 31" attempted h4a2? 
 		// Needed to prevent taking if file is A or H
 		auto pos = PositionFromFen("5k1r/1Rp1r3/2n1pp2/2Pp4/p4P1p/b3BRPB/P1P4P/6K1 b - - 3 31");
-		std::vector<Move> *moves(new std::vector<Move>());
-		pos.LegalPawnMoves<Any>(pos.ToMove(), moves);
-		for (auto m : *moves)
+		MoveList moves;
+		pos.LegalPawnMoves<Any>(pos.ToMove(), pos.GetLegalityMasks(), &moves);
+		for (auto m : moves)
 		{
 			std::cout << m << ": " << AsUci(m) << std::endl;
 		}
@@ -152,98 +157,99 @@ namespace Medusa
 		// Bug: one of the pawn attacks tables (e7) was incorrect.
 
 		auto position = PositionFromFen("");
-		position.ApplyUCI("e2e4");
-		position.ApplyUCI("b8c6");
-		position.ApplyUCI("d2d4");
-		position.ApplyUCI("g8f6");
-		position.ApplyUCI("b1c3");
-		position.ApplyUCI("d7d5");
-		position.ApplyUCI("e4d5");
-		position.ApplyUCI("f6d5");
-		position.ApplyUCI("g1f3");
-		position.ApplyUCI("d5c3");
-		position.ApplyUCI("b2c3");
-		position.ApplyUCI("d8d5");
-		position.ApplyUCI("c1e3");
-		position.ApplyUCI("c8f5");
-		position.ApplyUCI("f1d3");
-		position.ApplyUCI("e8c8");
-		position.ApplyUCI("d3f5");
-		position.ApplyUCI("d5f5");
-		position.ApplyUCI("d1d3");
-		position.ApplyUCI("f5d3");
-		position.ApplyUCI("c2d3");
-		position.ApplyUCI("d8d7");
-		position.ApplyUCI("c3c4");
-		position.ApplyUCI("c6b4");
-		position.ApplyUCI("e1d2");
-		position.ApplyUCI("d7d8");
-		position.ApplyUCI("h1b1");
-		position.ApplyUCI("b4c6");
-		position.ApplyUCI("a2a4");
-		position.ApplyUCI("d8d7");
-		position.ApplyUCI("a4a5");
-		position.ApplyUCI("h8g8");
-		position.ApplyUCI("a5a6");
-		position.ApplyUCI("b7b6");
-		position.ApplyUCI("d4d5");
-		position.ApplyUCI("c6a5");
-		position.ApplyUCI("f3d4");
-		position.ApplyUCI("d7d8");
-		position.ApplyUCI("d4c6");
-		position.ApplyUCI("a5c6");
-		position.ApplyUCI("d5c6");
-		position.ApplyUCI("d8d6");
-		position.ApplyUCI("b1b2");
-		position.ApplyUCI("d6g6");
-		position.ApplyUCI("b2b1");
-		position.ApplyUCI("g6g2");
-		position.ApplyUCI("b1b2");
-		position.ApplyUCI("g8h8");
-		position.ApplyUCI("a1b1");
-		position.ApplyUCI("g2h2");
-		position.ApplyUCI("b2b3");
-		position.ApplyUCI("h8g8");
-		position.ApplyUCI("b3b2");
-		position.ApplyUCI("h2h3");
-		position.ApplyUCI("b2b3");
-		position.ApplyUCI("g8h8");
-		position.ApplyUCI("b3b2");
-		position.ApplyUCI("h3h4");
-		position.ApplyUCI("b2b3");
-		position.ApplyUCI("h8g8");
-		position.ApplyUCI("b3b2");
-		position.ApplyUCI("h4h5");
-		position.ApplyUCI("b2b3");
-		position.ApplyUCI("h5a5");
-		position.ApplyUCI("b3b4");
-		position.ApplyUCI("a5a2");
-		position.ApplyUCI("d2c3");
-		position.ApplyUCI("a2a3");
-		position.ApplyUCI("b4b3");
-		position.ApplyUCI("a3b3");
-		position.ApplyUCI("b1b3");
-		position.ApplyUCI("g8h8");
-		position.ApplyUCI("c3d4");
-		position.ApplyUCI("c8b8");
-		position.ApplyUCI("e3f4");
-		position.ApplyUCI("h8g8");
-		position.ApplyUCI("d4e5");
-		position.ApplyUCI("f7f6");
-		position.ApplyUCI("e5e6");
-		position.ApplyUCI("g7g5");
-		position.ApplyUCI("e6d7");
-		position.ApplyUCI("g5f4");
-		position.ApplyUCI("f2f3");
-		position.ApplyUCI("g8g3");
-		position.ApplyUCI("d3d4");
-		position.ApplyUCI("f8h6");
-		position.ApplyUCI("d4d5");
-		position.ApplyUCI("g3g1");
-		position.ApplyUCI("c4c5");
-		position.ApplyUCI("g1g5");
-		position.ApplyUCI("c5b6");
-		position.ApplyUCI("g5d5");
+		PositionHistory history;
+		position.ApplyUCI("e2e4", history);
+		position.ApplyUCI("b8c6", history);
+		position.ApplyUCI("d2d4", history);
+		position.ApplyUCI("g8f6", history);
+		position.ApplyUCI("b1c3", history);
+		position.ApplyUCI("d7d5", history);
+		position.ApplyUCI("e4d5", history);
+		position.ApplyUCI("f6d5", history);
+		position.ApplyUCI("g1f3", history);
+		position.ApplyUCI("d5c3", history);
+		position.ApplyUCI("b2c3", history);
+		position.ApplyUCI("d8d5", history);
+		position.ApplyUCI("c1e3", history);
+		position.ApplyUCI("c8f5", history);
+		position.ApplyUCI("f1d3", history);
+		position.ApplyUCI("e8c8", history);
+		position.ApplyUCI("d3f5", history);
+		position.ApplyUCI("d5f5", history);
+		position.ApplyUCI("d1d3", history);
+		position.ApplyUCI("f5d3", history);
+		position.ApplyUCI("c2d3", history);
+		position.ApplyUCI("d8d7", history);
+		position.ApplyUCI("c3c4", history);
+		position.ApplyUCI("c6b4", history);
+		position.ApplyUCI("e1d2", history);
+		position.ApplyUCI("d7d8", history);
+		position.ApplyUCI("h1b1", history);
+		position.ApplyUCI("b4c6", history);
+		position.ApplyUCI("a2a4", history);
+		position.ApplyUCI("d8d7", history);
+		position.ApplyUCI("a4a5", history);
+		position.ApplyUCI("h8g8", history);
+		position.ApplyUCI("a5a6", history);
+		position.ApplyUCI("b7b6", history);
+		position.ApplyUCI("d4d5", history);
+		position.ApplyUCI("c6a5", history);
+		position.ApplyUCI("f3d4", history);
+		position.ApplyUCI("d7d8", history);
+		position.ApplyUCI("d4c6", history);
+		position.ApplyUCI("a5c6", history);
+		position.ApplyUCI("d5c6", history);
+		position.ApplyUCI("d8d6", history);
+		position.ApplyUCI("b1b2", history);
+		position.ApplyUCI("d6g6", history);
+		position.ApplyUCI("b2b1", history);
+		position.ApplyUCI("g6g2", history);
+		position.ApplyUCI("b1b2", history);
+		position.ApplyUCI("g8h8", history);
+		position.ApplyUCI("a1b1", history);
+		position.ApplyUCI("g2h2", history);
+		position.ApplyUCI("b2b3", history);
+		position.ApplyUCI("h8g8", history);
+		position.ApplyUCI("b3b2", history);
+		position.ApplyUCI("h2h3", history);
+		position.ApplyUCI("b2b3", history);
+		position.ApplyUCI("g8h8", history);
+		position.ApplyUCI("b3b2", history);
+		position.ApplyUCI("h3h4", history);
+		position.ApplyUCI("b2b3", history);
+		position.ApplyUCI("h8g8", history);
+		position.ApplyUCI("b3b2", history);
+		position.ApplyUCI("h4h5", history);
+		position.ApplyUCI("b2b3", history);
+		position.ApplyUCI("h5a5", history);
+		position.ApplyUCI("b3b4", history);
+		position.ApplyUCI("a5a2", history);
+		position.ApplyUCI("d2c3", history);
+		position.ApplyUCI("a2a3", history);
+		position.ApplyUCI("b4b3", history);
+		position.ApplyUCI("a3b3", history);
+		position.ApplyUCI("b1b3", history);
+		position.ApplyUCI("g8h8", history);
+		position.ApplyUCI("c3d4", history);
+		position.ApplyUCI("c8b8", history);
+		position.ApplyUCI("e3f4", history);
+		position.ApplyUCI("h8g8", history);
+		position.ApplyUCI("d4e5", history);
+		position.ApplyUCI("f7f6", history);
+		position.ApplyUCI("e5e6", history);
+		position.ApplyUCI("g7g5", history);
+		position.ApplyUCI("e6d7", history);
+		position.ApplyUCI("g5f4", history);
+		position.ApplyUCI("f2f3", history);
+		position.ApplyUCI("g8g3", history);
+		position.ApplyUCI("d3d4", history);
+		position.ApplyUCI("f8h6", history);
+		position.ApplyUCI("d4d5", history);
+		position.ApplyUCI("g3g1", history);
+		position.ApplyUCI("c4c5", history);
+		position.ApplyUCI("g1g5", history);
+		position.ApplyUCI("c5b6", history);
+		position.ApplyUCI("g5d5", history);
 
 		auto moves = position.LegalMoves<Any>();
 		for (auto m : moves)
@@ -251,7 +257,7 @@ namespace Medusa
 			std::cout << m << ": " << AsUci(m) << std::endl;
 		}
 
-		position.ApplyUCI("d7e7");
+		position.ApplyUCI("d7e7", history);
 	}
 
 	void test_game_phase()
@@ -298,9 +304,9 @@ namespace Medusa
 	void test_promotion_capture()
 	{
 		auto pos = PositionFromFen("6r1/7P/p7/Pr6/4pPK1/2k1B3/5P2/8 w - - 0 52");
-		std::vector<Move> *legals(new std::vector<Move>());
-		pos.LegalPawnMoves<Any>(1, legals);
-		for (auto m : *legals)
+		MoveList legals;
+		pos.LegalPawnMoves<Any>(1, pos.GetLegalityMasks(), &legals);
+		for (auto m : legals)
 		{
 			std::cout << AsUci(m) << std::endl;
 		}
@@ -319,31 +325,195 @@ namespace Medusa
 	void test_moves_sanity()
 	{
 		Position new_pos = PositionFromFen("");
-		new_pos.ApplyUCI("b1a3");
-		new_pos.ApplyUCI("b8c6");
-		new_pos.ApplyUCI("a3c4");
-		new_pos.ApplyUCI("d7d5");
-		new_pos.ApplyUCI("d2d4");
-		new_pos.ApplyUCI("c6d4");
+		PositionHistory history;
+		new_pos.ApplyUCI("b1a3", history);
+		new_pos.ApplyUCI("b8c6", history);
+		new_pos.ApplyUCI("a3c4", history);
+		new_pos.ApplyUCI("d7d5", history);
+		new_pos.ApplyUCI("d2d4", history);
+		new_pos.ApplyUCI("c6d4", history);
 
 	}
 
-	void benchmarks()
+	// Positions used for the benchmarks.
+	static const std::string benchmark_fens[] = {
+		"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+		"r1b2rk1/2q1bppp/2np1n2/pp2p3/3PP3/1N3N1P/PPB2PP1/R1BQR1K1 w - - 0 15",
+		"2k4r/ppprbppp/2n5/8/4RB2/2N5/PPP2PPP/R5K1 w - - 1 15",
+	};
+
+	// Walk the legal move tree to a fixed depth, counting the nodes.
+	size_t walk_tree(Position &pos, PositionHistory& history, int depth)
 	{
-		auto new_pos = PositionFromFen("");
-		new_pos.ApplyUCI("d2d4");
-		new_pos.ApplyUCI("b8c6");
-		new_pos.ApplyUCI("b1a3");
-		auto moves = new_pos.LegalMoves<Any>();
-		/*
-		for (auto move : moves)
+		if (depth == 0)
+			return 1;
+		size_t nodes = 0;
+		auto moves = pos.LegalMoves<Any>();
+		for (auto m : moves)
 		{
-			std::cout << AsUci(move) << std::endl;
+			pos.Apply(m, history);
+			nodes += walk_tree(pos, history, depth - 1);
+			pos.Unapply(m, history);
 		}
-		new_pos.PrettyPrint();
-		*/
+		return nodes;
 	}
-}
 
+	// Slider attacks by walking the rays against the magic lookups, and
+	// the PEXT lookups in a build for BMI2.
+	void benchmark_slider_attacks()
+	{
+		const int repeats = 20000;
+		std::vector<Bitboard> occupancies;
+		for (auto& fen : benchmark_fens)
+			occupancies.push_back(PositionFromFen(fen).Occupants());
+
+		auto time = [&](std::function<Bitboard(Square, Bitboard)> attacks) {
+			auto start = std::chrono::steady_clock::now();
+			Bitboard total(0);
+			for (int r = 0; r < repeats; r++)
+				for (auto& occ : occupancies)
+					for (int s = 0; s < 64; s++)
+						total = total ^ attacks(Square(s), occ);
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+			return std::make_pair(ms, total);
+		};
+
+		auto rays = time([](Square s, Bitboard occ) {
+			return DirectionAttacks(occ, s, rook_directions) | DirectionAttacks(occ, s, bishop_directions);
+		});
+
+		auto magics = time([](Square s, Bitboard occ) {
+			return rook_magics[s].MagicAttacks(occ) | bishop_magics[s].MagicAttacks(occ);
+		});
+
+		size_t lookups = size_t(repeats) * occupancies.size() * 64;
+		std::cout << "queen attacks: " << lookups << " lookups" << std::endl;
+		std::cout << "rays:   " << rays.first << " ms" << std::endl;
+		std::cout << "magics: " << magics.first << " ms" << std::endl;
+		if (!(rays.second == magics.second))
+			std::cout << "error: ray and magic attacks differ" << std::endl;
+
+#ifdef USE_PEXT
+		auto pext = time([](Square s, Bitboard occ) {
+			return rook_magics[s].PextAttacks(occ) | bishop_magics[s].PextAttacks(occ);
+		});
+		std::cout << "pext:   " << pext.first << " ms" << std::endl;
+		if (!(rays.second == pext.second))
+			std::cout << "error: ray and pext attacks differ" << std::endl;
 #endif
+	}
+
+	// Nodes per second of the legal move generation.
+	void benchmark_move_generation(int depth)
+	{
+		size_t nodes = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (auto& fen : benchmark_fens)
+		{
+			auto pos = PositionFromFen(fen);
+			PositionHistory history;
+			nodes += walk_tree(pos, history, depth);
+		}
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+		std::cout << "move generation: " << nodes << " nodes " << ms << " ms "
+			<< (1000 * nodes) / (ms + 1) << " nps" << std::endl;
+	}
 
+	// Standard perft positions with their known leaf counts.
+	struct PerftCase
+	{
+		const char* fen;
+		size_t depth;
+		size_t nodes;
+	};
+
+	const PerftCase perft_suite[] = {
+		{ "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609 },
+		{ "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603 },
+		{ "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6, 11030083 },
+		{ "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 5, 15833292 },
+		{ "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 5, 15833292 },
+		{ "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487 },
+		{ "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594 },
+	};
+
+	// Run the perft suite, true if every count is right. With more than one
+	// thread or a hash table the parallel perft is checked instead.
+	bool benchmark_perft_suite(int threads = 1, size_t hash_mb = 0)
+	{
+		bool all_passed = true;
+		size_t total_nodes = 0;
+		int64_t total_ms = 0;
+		for (auto& test : perft_suite)
+		{
+			auto pos = PositionFromFen(test.fen);
+			auto info = threads > 1 || hash_mb > 0
+				? ParallelPerft(pos, test.depth, false, threads, hash_mb)
+				: Search::Divide(pos, test.depth, false);
+			bool passed = info.nodes == test.nodes;
+			all_passed &= passed;
+			total_nodes += info.nodes;
+			total_ms += info.time_ms;
+			std::cout << (passed ? "ok   " : "FAIL ") << test.fen << " depth " << test.depth
+				<< ": " << info.nodes << " (expected " << test.nodes << ") "
+				<< info.time_ms << " ms" << std::endl;
+		}
+		std::cout << "perft: " << total_nodes << " nodes " << total_ms << " ms "
+			<< (1000 * total_nodes) / (total_ms + 1) << " nps" << std::endl;
+		return all_passed;
+	}
+
+	// Fixed depth searches of the perft suite positions, for measuring how 
+	// much of the tree the search gets through to reach a depth.
+	void benchmark_search(int depth)
+	{
+		size_t total_nodes = 0;
+		int64_t total_ms = 0;
+		PruningCounters pruned;
+		for (auto& test : perft_suite)
+		{
+			TranspositionTable tt(16);
+			Search search;
+			search.SetTranspositionTable(&tt);
+			auto pos = PositionFromFen(test.fen);
+			SearchLimits limits;
+			limits.depth = depth;
+			auto start = std::chrono::steady_clock::now();
+			search.SearchRoot(pos, PositionHistory(), limits);
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+			total_nodes += search.GetNodesSearched();
+			total_ms += ms;
+			pruned.reverse_futility += search.GetPruningCounters().reverse_futility;
+			pruned.futility += search.GetPruningCounters().futility;
+			pruned.razoring += search.GetPruningCounters().razoring;
+			pruned.see += search.GetPruningCounters().see;
+			pruned.delta += search.GetPruningCounters().delta;
+			pruned.late_move += search.GetPruningCounters().late_move;
+			std::cout << AsUci(search.GetBestMoveInfo().best_move) << " "
+				<< search.GetNodesSearched() << " nodes " << ms << " ms " << test.fen << std::endl;
+		}
+		std::cout << "search: depth " << depth << " " << total_nodes << " nodes " << total_ms << " ms "
+			<< (1000 * total_nodes) / (total_ms + 1) << " nps" << std::endl;
+		std::cout << "pruned: reverse futility " << pruned.reverse_futility
+			<< " futility " << pruned.futility
+			<< " razoring " << pruned.razoring
+			<< " see " << pruned.see
+			<< " delta " << pruned.delta
+			<< " late move " << pruned.late_move << std::endl;
+	}
+
+	void benchmarks()
+	{
+		benchmark_slider_attacks();
+
+		std::cout << (slider_backend == PEXT ? "pext " : "magic ");
+		benchmark_move_generation(3);
+	}
+}
+
+#endif
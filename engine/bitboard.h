@@ -79,6 +79,13 @@ namespace Medusa
 		{
 			return bit_number != 0;
 		}
+
+		// underlying 64 bit number
+		uint64_t Number() const
+		{
+			return bit_number;
+		}
+
 		// population count				
 		int PopCnt() const
 		{
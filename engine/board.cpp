@@ -83,8 +83,7 @@ namespace Medusa
 	// Convert bitboard to square
 	Square BbSqr(Bitboard bb)
 	{
-		return static_cast<Square>(bb.nMSB());
-		return square_lookup.at(bb);
+		return static_cast<Square>(bb.nLSB());
 	}
 	// Convert square to bitboard
 	Bitboard SqrBb(Square sqr)
@@ -353,7 +353,7 @@ namespace Medusa
 	Bitboard OffBit(Bitboard bb, Square off);
 	// Turn a square on
 	Bitboard OnBit(Bitboard bb, Square on);
-	// Convert bitboard to square
+	// Convert bitboard to square, the board must hold a single square
 	Square BbSqr(Bitboard bb);
 	// Convert square to bitboard
 	Bitboard SqrBb(Square sqr);
@@ -100,7 +100,7 @@ namespace Medusa
 			for (auto it = bsh.begin(); it != bsh.end(); it.operator++())
 			{
 				auto sqr = Square(*it);
-				auto _binf = DirectionAttacks(occupancy, sqr, bishop_directions);
+				auto _binf = BishopAttacks(sqr, occupancy);
 				score += _cbinf * (_binf & (~BB_CTR_SQR)).PopCnt();
 				score += _cbinf * (_binf & (BB_CTR_SQR)).PopCnt();
 			}
@@ -1,14 +1,51 @@
 #include <iostream>
 #include <string>
 
+#include "attacks.h"
 #include "benchmark.h"
+#include "search.h"
 #include "utils/logging.h"
 #include "uci.h"
+#include "zobrist.h"
 
 using namespace Medusa;
 
-int main()
+int main(int argc, char* argv[])
 {
+	if (slider_backend == PEXT && !CpuHasBmi2())
+	{
+		std::cerr << "This build uses BMI2, which this CPU does not have. "
+			"Use the build without it." << std::endl;
+		return 1;
+	}
+
+	InitAttacks();
+	InitZobrist();
+	InitSearch();
+
+	// Benchmarks
+	if (argc > 1 && std::string(argv[1]) == "bench")
+	{
+		benchmarks();
+		return 0;
+	}
+
+	// Fixed depth search of the benchmark positions.
+	if (argc > 1 && std::string(argv[1]) == "search")
+	{
+		benchmark_search(argc > 2 ? std::stoi(argv[2]) : 8);
+		return 0;
+	}
+
+	// Move generator check against known perft counts, optionally
+	// followed by the number of threads and hash megabytes.
+	if (argc > 1 && std::string(argv[1]) == "perft")
+	{
+		int threads = argc > 2 ? std::stoi(argv[2]) : 1;
+		size_t hash_mb = argc > 3 ? std::stoul(argv[3]) : 0;
+		return benchmark_perft_suite(threads, hash_mb) ? 0 : 1;
+	}
+
 	// Logging
 	auto now = std::chrono::system_clock::now();
 	auto filename = "medusa_" + FormatTime(now) + ".txt";
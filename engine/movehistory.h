@@ -0,0 +1,167 @@
+#ifndef movehistory_h
+#define movehistory_h
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include "board.h"
+#include "position.h"
+#include "types.h"
+
+namespace Medusa
+{
+	// Killer moves kept per ply.
+	constexpr int num_killers = 2;
+
+	// Deepest ply from the root the search keeps anything for.
+	constexpr int max_ply = 256;
+
+	// History scores stay within this either side of zero, so they fit in
+	// 16 bits and the tables stay small enough to sit in cache.
+	constexpr int history_max = 16384;
+
+	// Move an entry towards the bonus (or malus), by less the nearer the 
+	// entry already is to the bound. This keeps entries in range without
+	// clamping and lets recent results outweigh old ones.
+	inline void UpdateHistory(int16_t& entry, int bonus)
+	{
+		bonus = std::max(-history_max, std::min(history_max, bonus));
+		entry += int16_t(bonus - entry * std::abs(bonus) / history_max);
+	}
+
+	// Bonus for a move which caused a cutoff with this depth left, deeper
+	// cutoffs save more and count more.
+	inline int HistoryBonus(int depth)
+	{
+		return std::min(16 * depth * depth, 1600);
+	}
+
+	// Scores of moves by the piece moved and its destination.
+	typedef int16_t PieceToHistory[NUMBER_PIECES][64];
+
+	// What a search has learned about which moves do well, for ordering.
+	// Each search thread has its own, so updates need no synchronisation.
+	struct MoveHistory
+	{
+		// Quiet moves by side to move, from and to square.
+		int16_t butterfly[2][64][64];
+
+		// Quiet moves by the move one (or two) plies before, its piece and
+		// destination, then the side to move.
+		PieceToHistory continuation[2][NUMBER_PIECES][64][2];
+
+		// Captures by side to move, piece, destination and piece taken. A 
+		// promotion which takes nothing counts as taking a king, which no
+		// capture can.
+		int16_t captures[2][NUMBER_PIECES][64][NUMBER_PIECES];
+
+		// The quiet move which last refuted a move, by its piece and 
+		// destination and the side to move.
+		Move countermoves[NUMBER_PIECES][64][2];
+
+		// Quiet moves which caused a cutoff at the same ply elsewhere.
+		Move killers[max_ply][num_killers];
+
+		void Clear()
+		{
+			std::memset(butterfly, 0, sizeof(butterfly));
+			std::memset(continuation, 0, sizeof(continuation));
+			std::memset(captures, 0, sizeof(captures));
+			std::memset(countermoves, 0, sizeof(countermoves));
+			std::memset(killers, 0, sizeof(killers));
+		}
+
+		// The continuation scores following the move so many plies back,
+		// null when there was no move (or a null move).
+		const PieceToHistory* Continuation(
+			const Position& position,
+			const PositionHistory& position_history,
+			int plies) const
+		{
+			auto prev = position_history.Back(plies);
+			if (!prev || !prev->move)
+				return nullptr;
+			return &continuation[plies - 1][prev->piece][GetTo(prev->move)][position.ToMove().Index()];
+		}
+
+		PieceToHistory* Continuation(
+			const Position& position,
+			const PositionHistory& position_history,
+			int plies)
+		{
+			auto prev = position_history.Back(plies);
+			if (!prev || !prev->move)
+				return nullptr;
+			return &continuation[plies - 1][prev->piece][GetTo(prev->move)][position.ToMove().Index()];
+		}
+
+		Move CounterMove(const Position& position, const PositionHistory& position_history) const
+		{
+			auto prev = position_history.Back(1);
+			if (!prev || !prev->move)
+				return 0;
+			return countermoves[prev->piece][GetTo(prev->move)][position.ToMove().Index()];
+		}
+
+		int Quiet(Colour colour, Move move) const
+		{
+			return butterfly[colour.Index()][GetFrom(move)][GetTo(move)];
+		}
+
+		int Capture(const Position& position, Move move) const
+		{
+			return captures[position.ToMove().Index()][position.GetAttacker(move)][GetTo(move)][Taken(position, move)];
+		}
+
+		// A quiet move which caused a cutoff (or with a negative bonus, did
+		// not), and is the new countermove if it did.
+		void UpdateQuiet(
+			const Position& position,
+			const PositionHistory& position_history,
+			Move move,
+			int bonus)
+		{
+			auto us = position.ToMove();
+			auto piece = position.GetAttacker(move);
+			UpdateHistory(butterfly[us.Index()][GetFrom(move)][GetTo(move)], bonus);
+			for (int plies = 1; plies <= 2; plies++)
+			{
+				if (auto cont = Continuation(position, position_history, plies))
+					UpdateHistory((*cont)[piece][GetTo(move)], bonus);
+			}
+
+			auto prev = position_history.Back(1);
+			if (bonus > 0 && prev && prev->move)
+				countermoves[prev->piece][GetTo(prev->move)][us.Index()] = move;
+		}
+
+		void UpdateCapture(const Position& position, Move move, int bonus)
+		{
+			UpdateHistory(captures[position.ToMove().Index()][position.GetAttacker(move)][GetTo(move)][Taken(position, move)], bonus);
+		}
+
+		// Newest first, without repeats.
+		void AddKiller(int dfr, Move move)
+		{
+			Move* ply_killers = killers[dfr];
+			if (ply_killers[0] == move)
+				return;
+			for (int i = num_killers - 1; i > 0; i--)
+				ply_killers[i] = ply_killers[i - 1];
+			ply_killers[0] = move;
+		}
+
+	private:
+		static Piece Taken(const Position& position, Move move)
+		{
+			if (SpecialMoveType(move) == CAPTURE_ENPASSANT)
+				return PAWN;
+			auto taken = position.Captured(move);
+			return taken == NO_PIECE ? KING : taken;
+		}
+	};
+};
+
+#endif
@@ -2,107 +2,285 @@
 
 namespace Medusa
 {
-	MoveSelector::MoveSelector(Position& position_, bool allmvs)
+	using namespace Evaluation;
+
+	// Piece values for ordering captures, a legal capture by the king can
+	// never be answered so it counts as the least valuable attacker.
+	static const int order_values[NUMBER_PIECES] = {
+		KnightValue, BishopValue, RookValue, QueenValue, 0, PawnValue
+	};
+
+	int Victim(const Position& position, Move move)
 	{
-		/// Hand crafted logic for ordering the moves currently 
-		/// legal in the position. We prioritize the checks and
-		/// captures to look at first, with the least valuable 
-		/// piece capturing the most valuable first. 
-		Position position = position_;
-		auto mvs = position.LegalMoves<Medusa::Any>();
-		auto turn = position.ToMove();
-		
-		/// The guessed constants for prioritising certain moves.
-		/// the values guarantee that checks are considered before 
-		/// captures but captures over other moves. It also discourages
-		/// moving the same piece twice. This may be complete non-
-		/// sense though and is just a placeholder for more robust 
-		/// treatment in the future.
-		const int _cvallst = 10;
-		const int _cvalchk = 50;
-		const int _cvalcap = 25;
-
-		/// Iterate through all legal moves, there is an option to 
-		/// include all moves or just checks/captures which this loop
-		/// respects. If we find a checkmate, then just exit with that
-		/// as the only move... that is probably not correct behaviour.
-		for (auto &mv : mvs)
+		auto special = SpecialMoveType(move);
+		int victim = 0;
+		if (special == CAPTURE_ENPASSANT)
+			victim = PawnValue;
+		else if (position.MoveIsCapture(move))
+			victim = order_values[position.Captured(move)];
+		if (special == PROMOTE)
+			victim += order_values[PromotionPiece(move)] - PawnValue;
+		return victim;
+	}
+
+	MoveSelector::MoveSelector(
+		Position& position_,
+		const PositionHistory& position_history_,
+		Move hash_move_,
+		const Move* killers_,
+		const MoveHistory* history_,
+		bool include_quiet_,
+		bool include_checks_)
+		:
+		position(position_),
+		position_history(position_history_),
+		masks(position_.GetLegalityMasks()),
+		stage(HASH_MOVE),
+		hash_move(hash_move_),
+		history(history_),
+		killer_index(0),
+		index(0),
+		bad_index(0),
+		move_score(0),
+		include_checks(include_checks_)
+	{
+		// Evading a check needs all of the moves, there are few anyway.
+		include_quiet = include_quiet_ || bool(masks.checkers);
+		for (int i = 0; i < num_killers; i++)
+			killers[i] = killers_ ? killers_[i] : 0;
+		killers[num_killers] = history ? history->CounterMove(position, position_history) : 0;
+	}
+
+	Move MoveSelector::Next()
+	{
+		move_score = 0;
+		switch (stage)
 		{
-			/// Get the attacker in the move, and which square it is 
-			/// originating. The value of that piece is PAWN-attkr, check
-			/// if it is a capture.
-			auto attkr = position.GetAttacker(mv);
-			auto mvfrm = GetFrom(mv);
-			int mvval = PAWN - attkr;
-			bool iscap = position.MoveIsCapture(mv);
-
-			// Apply the move and do necessary checks
-			position.Apply(mv);
-			bool ischk = position.IsInCheck();
-			if (!allmvs && !(ischk || iscap)) {
-				position.Unapply(mv);
-				continue;
-			}
-			// Encourage checks/captures first
-			if (iscap)
-				mvval += _cvalcap;
-			if (ischk)
+		case HASH_MOVE:
+		{
+			stage = GENERATE_CAPTURES;
+			bool noisy = position.MoveIsCapture(hash_move) || SpecialMoveType(hash_move) == PROMOTE;
+			if (hash_move && (include_quiet || noisy) && position.IsLegal(hash_move, masks))
+				return hash_move;
+		}
+		// fall through
+		case GENERATE_CAPTURES:
+			position.LegalMoves<Capture>(&moves, masks);
+			ScoreCaptures();
+			stage = GOOD_CAPTURES;
+		// fall through
+		case GOOD_CAPTURES:
+			while (index < moves.size())
 			{
-				if (!position.AnyLegalMove())
+				auto best = PickBest();
+				if (best.move == hash_move)
+					continue;
+
+				// Taking with a more valuable piece might lose material,
+				// if it does then try it after the quiet moves.
+				int attacker = order_values[position.GetAttacker(best)];
+				if (attacker > Victim(position, best) && SEE(position, best) < 0)
 				{
-					position.Unapply(mv);
-					moves.clear();
-					moves.insert({ 0, mv });
-					break;
+					bad_captures.emplace_back(best.move, best.score);
+					continue;
 				}
-				else mvval += _cvalchk;
+				return best;
+			}
+			if (include_quiet)
+				stage = KILLERS;
+			else
+				stage = include_checks ? GENERATE_CHECKS : BAD_CAPTURES;
+			return Next();
+		case KILLERS:
+			while (killer_index < num_killers + 1)
+			{
+				Move killer = killers[killer_index++];
+				if (!killer || killer == hash_move)
+					continue;
+				if (std::find(killers, killers + killer_index - 1, killer) != killers + killer_index - 1)
+					continue;
+				if (position.MoveIsCapture(killer) || SpecialMoveType(killer) == PROMOTE)
+					continue;
+				if (position.IsLegal(killer, masks))
+					return killer;
+			}
+			stage = GENERATE_QUIETS;
+		// fall through
+		case GENERATE_QUIETS:
+			moves.clear();
+			index = 0;
+			position.LegalMoves<Quiet>(&moves, masks);
+			ScoreQuiets();
+			stage = QUIETS;
+		// fall through
+		case QUIETS:
+			while (index < moves.size())
+			{
+				auto best = PickBest();
+				if (best.move == hash_move)
+					continue;
+				if (std::find(killers, killers + num_killers + 1, best.move) != killers + num_killers + 1)
+					continue;
+				move_score = best.score;
+				return best;
+			}
+			stage = BAD_CAPTURES;
+			return Next();
+		case GENERATE_CHECKS:
+			moves.clear();
+			index = 0;
+			position.LegalQuietChecks(&moves, masks);
+			stage = QUIET_CHECKS;
+		// fall through
+		case QUIET_CHECKS:
+			while (index < moves.size())
+			{
+				Move move = moves[index++];
+				if (move != hash_move)
+					return move;
 			}
-			// Discourage same piece repeatedly.
-			if (position.LastMoved(attkr, mvfrm))
-				mvval -= _cvallst;
+			stage = BAD_CAPTURES;
+		// fall through
+		case BAD_CAPTURES:
+			if (bad_index < bad_captures.size())
+				return bad_captures[bad_index++];
+			stage = DONE;
+		// fall through
+		case DONE:
+			return 0;
+		}
+		return 0;
+	}
 
-			position.Unapply(mv);
-			moves.insert({ -mvval, mv });
-		};
+	// Most valuable victim first, then least valuable attacker, then how 
+	// the capture has done before.
+	void MoveSelector::ScoreCaptures()
+	{
+		for (auto& mv : moves)
+		{
+			mv.score = 8 * Victim(position, mv) - order_values[position.GetAttacker(mv)];
+			if (history)
+				mv.score += history->Capture(position, mv) / 16;
+		}
 	}
 
-	int MoveSelector::SEE(Position &pos, Move move)
+	// By how often each move has caused a cutoff, in general and after the
+	// last two moves. Without a history only discourage moving the same 
+	// piece twice.
+	void MoveSelector::ScoreQuiets()
 	{
-		int value = 0;
+		if (history)
+		{
+			auto us = position.ToMove();
+			const PieceToHistory* cont[2] = {
+				history->Continuation(position, position_history, 1),
+				history->Continuation(position, position_history, 2)
+			};
+			for (auto& mv : moves)
+			{
+				mv.score = history->Quiet(us, mv);
+				auto piece = position.GetAttacker(mv);
+				for (auto c : cont)
+				{
+					if (c)
+						mv.score += (*c)[piece][GetTo(mv)];
+				}
+			}
+			return;
+		}
 
-		// Get smallest attacker capture
-		auto next_moves = pos.LegalMoves<Capture>();
-		auto remove_condition = [pos](Move m) { return !pos.MoveIsCapture(m); };
-		auto to_remove = std::remove_if(next_moves.begin(), next_moves.end(), remove_condition);
-		next_moves.erase(to_remove, next_moves.end());
+		const int _cvallst = 10;
+		for (auto& mv : moves)
+			mv.score = position_history.LastMoved(GetFrom(mv)) ? -_cvallst : 0;
+	}
 
-		bool capture_exists = next_moves.size();
-		if (!capture_exists)
+	// Bring the best of the remaining moves forward, this is cheaper than
+	// sorting when an early move causes a cutoff.
+	ScoredMove MoveSelector::PickBest()
+	{
+		size_t best = index;
+		for (size_t i = index + 1; i < moves.size(); i++)
 		{
-			return value;
+			if (moves[i].score > moves[best].score)
+				best = i;
 		}
+		std::swap(moves[index], moves[best]);
+		return moves[index++];
+	}
 
-		// Get the smallest attacker
-		auto next_move = next_moves.back();
-		int smallest_attacker = 100000;
-		for (auto m : next_moves)
+	// Piece values for exchanges, the king is only ever the last to take.
+	static const int see_values[NUMBER_PIECES] = {
+		KnightValue, BishopValue, RookValue, QueenValue, KingValue, PawnValue
+	};
+
+	// Least valuable first.
+	static const Piece exchange_order[NUMBER_PIECES] = {
+		PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING
+	};
+
+	// Material won by a move once the exchanges on its square have been
+	// played out, each side taking with its least valuable piece and 
+	// stopping when taking would lose. Pieces are only taken off a copy 
+	// of the occupancy, revealing any sliders behind them.
+	int SEE(const Position& position, Move move)
+	{
+		auto special = SpecialMoveType(move);
+		if (special == CASTLE)
+			return 0;
+
+		auto from = GetFrom(move);
+		auto to = GetTo(move);
+		auto occupancy = position.Occupants() ^ squares[from];
+		if (special == CAPTURE_ENPASSANT)
+			occupancy = occupancy ^ squares[position.ToMove().IsWhite() ? to - 8 : to + 8];
+
+		// Gain of each capture in the sequence for the side making it, if
+		// the sequence stopped there.
+		int gain[32];
+		int d = 0;
+		gain[0] = Victim(position, move);
+		int on_square = special == PROMOTE
+			? see_values[PromotionPiece(move)]
+			: see_values[position.GetAttacker(move)];
+
+		auto side = ~position.ToMove();
+		auto attackers = position.AttackersTo(to, occupancy);
+		while (d < 31)
 		{
-			int attacker = Evaluation::piece_values.at(pos.GetAttacker(next_move));
-			if (attacker <= smallest_attacker)
+			auto ours = attackers & position.Occupants(side);
+			if (!ours)
+				break;
+
+			Piece piece = KING;
+			Bitboard candidates;
+			for (auto p : exchange_order)
 			{
-				smallest_attacker = attacker;
-				next_move = m;
+				candidates = ours & position.PieceBoard(side, p);
+				if (candidates)
+				{
+					piece = p;
+					break;
+				}
 			}
-		}
 
-		// === Apply ====
-		auto captured = pos.Captured(next_move);
-		pos.Apply(next_move);
-		int capture_value = Evaluation::piece_values.at(captured) - SEE(pos, next_move);
-		pos.Unapply(next_move);
-		// === unapply ====
+			// The king can not take a defended piece.
+			if (piece == KING && (attackers & position.Occupants(~side)))
+				break;
+
+			d++;
+			gain[d] = on_square - gain[d - 1];
+			on_square = see_values[piece];
+			occupancy = occupancy ^ squares[candidates.nLSB()];
+			attackers = position.AttackersTo(to, occupancy);
+			side = ~side;
+		}
 
-		value = capture_value > 0 ? capture_value : 0;
-		return value;
+		// Either side may stop taking when it would do better to.
+		while (d > 0)
+		{
+			gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+			d--;
+		}
+		return gain[0];
 	}
-};
\ No newline at end of file
+};
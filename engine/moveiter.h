@@ -1,21 +1,84 @@
 #pragma once
-#include <map>
 #include "evaluation.h"
+#include "movehistory.h"
+#include "movelist.h"
 #include "position.h"
 
 namespace Medusa
 {
+	// Material taken by a move, counting what a promotion adds.
+	int Victim(const Position& position, Move move);
+
+	// Material won (or lost if negative) by a move, once the exchanges on
+	// its square have been played out. The position is left untouched.
+	int SEE(const Position& position, Move move);
+
+	// The move selector hands out moves in stages and only generates the
+	// moves of a stage once it is reached, so a cutoff on the hash move or
+	// a good capture saves generating (and ordering) the quiet moves.
+	enum SelectorStage
+	{
+		HASH_MOVE,
+		GENERATE_CAPTURES,
+		GOOD_CAPTURES,
+		KILLERS,
+		GENERATE_QUIETS,
+		QUIETS,
+		// Quiescence only, in place of the killers and quiets.
+		GENERATE_CHECKS,
+		QUIET_CHECKS,
+		BAD_CAPTURES,
+		DONE
+	};
+
 	class MoveSelector
 	{
 
 	public:
-		MoveSelector(Position &pos, bool include_quiet);
-		bool Any() const { return !moves.empty(); }
-		auto GetMoves() const { return moves; }
-		size_t NumMoves() const { return moves.size(); }
-		int SEE(Position &pos, Move move);
+		// The hash move and killers may be 0 when there are none. The 
+		// move history may be null, then moves are ordered without it and
+		// there is no countermove. Without quiets only captures and promotions
+		// are given, unless in check, and optionally the quiet moves which
+		// give check.
+		MoveSelector(
+			Position &pos,
+			const PositionHistory& position_history,
+			Move hash_move,
+			const Move* killers,
+			const MoveHistory* history,
+			bool include_quiet,
+			bool include_checks = false);
+
+		// The next move to search, 0 when there are none left.
+		Move Next();
+
+		SelectorStage Stage() const { return stage; }
+
+		// The ordering score of the last move given if it was a quiet move
+		// from the QUIETS stage, otherwise 0.
+		int MoveScore() const { return move_score; }
+
 
 	private:
-		std::multimap<int, Move> moves;
+		void ScoreCaptures();
+		void ScoreQuiets();
+		ScoredMove PickBest();
+
+		Position& position;
+		const PositionHistory& position_history;
+		LegalityMasks masks;
+		SelectorStage stage;
+		Move hash_move;
+		// The killers, then the countermove.
+		Move killers[num_killers + 1];
+		const MoveHistory* history;
+		int killer_index;
+		MoveList moves;
+		size_t index;
+		MoveList bad_captures;
+		size_t bad_index;
+		int move_score;
+		bool include_quiet;
+		bool include_checks;
 	};
-};
\ No newline at end of file
+};
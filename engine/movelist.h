@@ -0,0 +1,81 @@
+#ifndef movelist_h
+#define movelist_h
+
+#include <algorithm>
+
+#include "types.h"
+
+namespace Medusa
+{
+	// No legal position has more than 218 moves.
+	constexpr size_t max_moves = 256;
+
+	// Move with a score for ordering, converts back to a plain move.
+	struct ScoredMove
+	{
+		Move move;
+		int score;
+
+		operator Move() const { return move; }
+	};
+
+	// Fixed capacity list of moves. It lives on the stack so that
+	// generating moves at a node never touches the heap.
+	class MoveList
+	{
+	public:
+		MoveList() : length(0) {}
+
+		void emplace_back(Move move, int score = 0)
+		{
+			moves[length++] = { move, score };
+		}
+
+		void push_back(Move move)
+		{
+			emplace_back(move);
+		}
+
+		ScoredMove* begin() { return moves; }
+		ScoredMove* end() { return moves + length; }
+		const ScoredMove* begin() const { return moves; }
+		const ScoredMove* end() const { return moves + length; }
+
+		ScoredMove& operator[](size_t i) { return moves[i]; }
+		const ScoredMove& operator[](size_t i) const { return moves[i]; }
+		ScoredMove& back() { return moves[length - 1]; }
+
+		size_t size() const { return length; }
+		bool empty() const { return length == 0; }
+		void clear() { length = 0; }
+
+		// Remove a range of moves, keeping the order of the rest.
+		ScoredMove* erase(ScoredMove* first, ScoredMove* last)
+		{
+			auto new_end = std::move(last, end(), first);
+			length = new_end - moves;
+			return first;
+		}
+
+		// Order by score, highest first. Equal scores keep generation order.
+		// Insertion sort since the lists are short and it does not allocate
+		// a buffer like std::stable_sort.
+		void Sort()
+		{
+			for (size_t i = 1; i < length; i++)
+			{
+				ScoredMove tmp = moves[i];
+				size_t j = i;
+				for (; j > 0 && moves[j - 1].score < tmp.score; j--)
+					moves[j] = moves[j - 1];
+				moves[j] = tmp;
+			}
+		}
+
+	private:
+		ScoredMove moves[max_moves];
+		size_t length;
+	};
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "perft.h"
+
+namespace Medusa
+{
+	PerftTable::PerftTable(size_t megabytes)
+	{
+		size_t count = 1;
+		while (2 * count * sizeof(Entry) <= megabytes * 1024 * 1024)
+			count *= 2;
+		entries.reset(new Entry[count]);
+		for (size_t i = 0; i < count; i++)
+		{
+			entries[i].check.store(0, std::memory_order_relaxed);
+			entries[i].data.store(0, std::memory_order_relaxed);
+		}
+		mask = count - 1;
+	}
+
+	// The depth goes in the low byte of the data, the count above it.
+	bool PerftTable::Probe(uint64_t key, size_t depth, size_t* nodes) const
+	{
+		const Entry& entry = entries[key & mask];
+		uint64_t check = entry.check.load(std::memory_order_relaxed);
+		uint64_t data = entry.data.load(std::memory_order_relaxed);
+		if ((check ^ data) != key || (data & 0xff) != depth)
+			return false;
+		*nodes = size_t(data >> 8);
+		return true;
+	}
+
+	void PerftTable::Store(uint64_t key, size_t depth, size_t nodes)
+	{
+		Entry& entry = entries[key & mask];
+		uint64_t data = (uint64_t(nodes) << 8) | depth;
+		entry.check.store(key ^ data, std::memory_order_relaxed);
+		entry.data.store(data, std::memory_order_relaxed);
+	}
+
+	// Perft as in Search::Perft, looking up and storing subtree counts.
+	static size_t HashPerft(
+		Position& position,
+		PositionHistory& history,
+		size_t depth,
+		PerftTable* table)
+	{
+		if (depth == 0)
+			return 1;
+		MoveList legals;
+		position.LegalMoves<Any>(&legals);
+		if (depth == 1)
+			return legals.size();
+
+		size_t nodes = 0;
+		auto key = position.Key();
+		if (table && table->Probe(key, depth, &nodes))
+			return nodes;
+
+		for (auto m : legals)
+		{
+			position.Apply(m, history);
+			nodes += HashPerft(position, history, depth - 1, table);
+			position.Unapply(m, history);
+		}
+
+		if (table)
+			table->Store(key, depth, nodes);
+		return nodes;
+	}
+
+	PerftInfo ParallelPerft(
+		const Position& position,
+		size_t depth,
+		bool divide,
+		int threads,
+		size_t hash_mb)
+	{
+		PerftInfo info;
+		auto start = std::chrono::steady_clock::now();
+		std::unique_ptr<PerftTable> table;
+		if (hash_mb > 0)
+			table.reset(new PerftTable(hash_mb));
+
+		MoveList legals;
+		position.LegalMoves<Any>(&legals);
+		std::vector<size_t> counts(legals.size(), depth == 1 ? 1 : 0);
+
+		// The work is split into the replies to each root move, there are
+		// too few root moves to keep many threads busy to the end.
+		struct Task
+		{
+			size_t root;
+			Move reply;
+		};
+		std::vector<Task> tasks;
+		if (depth >= 2)
+		{
+			Position copy = position;
+			PositionHistory history;
+			for (size_t i = 0; i < legals.size(); i++)
+			{
+				copy.Apply(legals[i], history);
+				for (auto reply : copy.LegalMoves<Any>())
+					tasks.push_back({ i, reply });
+				copy.Unapply(legals[i], history);
+			}
+		}
+		std::vector<size_t> task_counts(tasks.size(), 0);
+
+		// Each thread takes the next task not yet taken, so a thread with
+		// quick subtrees goes on to take more of them.
+		std::atomic<size_t> next_task{ 0 };
+		auto worker = [&]()
+		{
+			Position copy = position;
+			PositionHistory history;
+			size_t t;
+			while ((t = next_task.fetch_add(1)) < tasks.size())
+			{
+				auto root = legals[tasks[t].root];
+				copy.Apply(root, history);
+				copy.Apply(tasks[t].reply, history);
+				task_counts[t] = HashPerft(copy, history, depth - 2, table.get());
+				copy.Unapply(tasks[t].reply, history);
+				copy.Unapply(root, history);
+			}
+		};
+
+		if (depth == 0)
+			info.nodes = 1;
+		else
+		{
+			std::vector<std::thread> workers;
+			for (int t = 1; t < threads; t++)
+				workers.emplace_back(worker);
+			worker();
+			for (auto& w : workers)
+				w.join();
+
+			for (size_t t = 0; t < tasks.size(); t++)
+				counts[tasks[t].root] += task_counts[t];
+			for (size_t i = 0; i < legals.size(); i++)
+			{
+				if (divide)
+					info.divide.emplace_back(legals[i], counts[i]);
+				info.nodes += counts[i];
+			}
+		}
+
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		info.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+		return info;
+	}
+};
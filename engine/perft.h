@@ -0,0 +1,48 @@
+#ifndef perft_h
+#define perft_h
+
+#include <atomic>
+#include <memory>
+
+#include "position.h"
+#include "search.h"
+
+namespace Medusa
+{
+	// Subtree counts shared between the perft threads, without locks. An
+	// entry is stored as the data and the key XOR the data, so if another
+	// thread tears an entry while it is being read the key does not match
+	// and the entry is ignored.
+	class PerftTable
+	{
+	public:
+		// Size in megabytes, rounded down to a power of two entries.
+		explicit PerftTable(size_t megabytes);
+
+		bool Probe(uint64_t key, size_t depth, size_t* nodes) const;
+		void Store(uint64_t key, size_t depth, size_t nodes);
+
+	private:
+		struct Entry
+		{
+			std::atomic<uint64_t> check;
+			std::atomic<uint64_t> data;
+		};
+
+		std::unique_ptr<Entry[]> entries;
+		size_t mask;
+	};
+
+	// Perft with the replies to the root moves shared out between threads,
+	// which cache
+	// subtree counts in a table of the given size (none if 0). Gives the 
+	// same counts as Search::Divide.
+	PerftInfo ParallelPerft(
+		const Position& position,
+		size_t depth,
+		bool divide,
+		int threads,
+		size_t hash_mb);
+};
+
+#endif
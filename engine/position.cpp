@@ -7,82 +7,55 @@
 namespace Medusa
 {
 
-	std::vector<Position> PositionHistory::history;
-
-	void Position::Apply(Move move)
+	void Position::Apply(Move move, PositionHistory& history)
 	{
-		PositionHistory::Push(*this);
-
 		auto special_flag = SpecialMoveType(move);
 		auto us = ToMove();
 		auto them = ~us;
-		int idx = us.Index();
-		int them_idx = them.Index();
 		auto start = GetFrom(move);
 		auto finish = GetTo(move);
-		bool reset50 = false;
+		auto piece = Piece(mailbox[start]);
+		auto captured = Piece(mailbox[finish]);
+
+		history.Push({ move, int8_t(piece), int8_t(captured), castling, fifty_counter, enpassant, key });
+		bool reset50 = piece == PAWN;
 		bool clear_enpassant = true;
 
-		// Move piece from, no matter what.
-		int p = 0;
-		for (p = 0; p < NUMBER_PIECES; p++)
+		// The square passed over is only kept when one of their pawns can
+		// take on it, otherwise the key would tell apart positions which
+		// play the same.
+		if (piece == PAWN && abs(finish - start) > 15)
 		{
-			auto our_piece = bitboards[idx][p];
-			if (IsOn(our_piece, start))
+			auto passed = Square(us.IsWhite() ? finish - 8 : start - 8);
+			if (PawnAttacks(us, passed) & bitboards[them.Index()][PAWN])
 			{
-				if (p == PAWN)
-					reset50 = true;
-
-				if (p == PAWN && abs(finish - start) > 15)
-				{
-					Bitboard new_enpassant(1ULL << (us.IsWhite() ? (finish - 8) : (start - 8)));
-					enpassant = new_enpassant;
-					clear_enpassant = false;
-				}
-
-				if (p == KING) {
-					DisableCastling(us);
-				}
+				SetEnPassant(squares[passed]);
+				clear_enpassant = false;
+			}
+		}
 
-				if (p == ROOK) {
-					switch (start) {
-					case(a1):
-					{
-						DisableCastling(W_QUEENSIDE);
-						break;
-					}
-					case(h1):
-					{
-						DisableCastling(W_KINGSIDE);
-						break;
-					}
-					case(a8):
-					{
-						DisableCastling(B_QUEENSIDE);
-						break;
-					}
-					case(h8):
-					{
-						DisableCastling(B_KINGSIDE);
-						break;
-					}
-					}
-				}
+		if (piece == KING) {
+			DisableCastling(us);
+		}
 
-				bitboards[idx][p] = OffBit(our_piece, start);
-				break;
+		// A rook moving from, or taken on, its starting square can no 
+		// longer castle.
+		for (auto sqr : { start, finish })
+		{
+			switch (sqr) {
+			case(a1): DisableCastling(W_QUEENSIDE); break;
+			case(h1): DisableCastling(W_KINGSIDE); break;
+			case(a8): DisableCastling(B_QUEENSIDE); break;
+			case(h8): DisableCastling(B_KINGSIDE); break;
+			default: break;
 			}
 		}
 
 		// Kill piece on destination (capture)
-		for (int p = 0; p < NUMBER_PIECES; p++) {
-			auto their_pieces = bitboards[them_idx][p];
-			if (IsOn(their_pieces, finish))
-			{
-				bitboards[them_idx][p] = OffBit(their_pieces, finish);
-				reset50 = true;
-				break;
-			}
+		if (captured != NO_PIECE)
+		{
+			RemovePiece(them, captured, finish);
+			reset50 = true;
 		}
 
 		// Special move related...
@@ -90,40 +63,29 @@ namespace Medusa
 		{
 		case(CAPTURE_ENPASSANT):
 		{
-			// TODO: implement white POV only, for now colour logic.
-			reset50 = true;
-			auto their_pawns = bitboards[them_idx][PAWN];
-			auto their_enpassant_pawn = us.IsWhite() ? (enpassant >> 8) : (enpassant << 8);
-			bitboards[them_idx][PAWN] = their_pawns & ~their_enpassant_pawn; //kill pawn
-			auto our_pawns = bitboards[idx][PAWN];
-			bitboards[idx][PAWN] = our_pawns | enpassant;
+			auto taken = Square(us.IsWhite() ? finish - 8 : finish + 8);
+			RemovePiece(them, PAWN, taken);
+			MovePiece(us, PAWN, start, finish);
 			break;
 		}
 		case(PROMOTE):
 		{
-			reset50 = true;
-			auto promote_piece = PromotionPiece(move);
-			auto our_promote_pieces = bitboards[idx][promote_piece];
-			bitboards[idx][promote_piece] = OnBit(our_promote_pieces, finish);
+			RemovePiece(us, PAWN, start);
+			AddPiece(us, PromotionPiece(move), finish);
 			break;
 		}
 		case(CASTLE):
 		{
-			auto our_king = bitboards[idx][KING];
-			bitboards[idx][KING] = OnBit(our_king, finish);
-			auto our_rooks = bitboards[idx][ROOK];
+			MovePiece(us, KING, start, finish);
 			bool queenside = (finish % 8) < 4;
 			auto rook_from = Square(queenside ? finish - 2 : finish + 1);
 			auto rook_to = Square(queenside ? finish + 1 : finish - 1);
-			bitboards[idx][ROOK] = BitMove(our_rooks, rook_from, rook_to);
+			MovePiece(us, ROOK, rook_from, rook_to);
 			DisableCastling(us);
 			break;
 		}
-		case(NONE):
-		{
-			auto our_piece = bitboards[idx][p];
-			bitboards[idx][p] = OnBit(our_piece, finish);
-		}
+		default:
+			MovePiece(us, piece, start, finish);
 		}
 
 		if (reset50)
@@ -132,21 +94,75 @@ namespace Medusa
 			fifty_counter++;
 
 		if (clear_enpassant)
-			enpassant = 0;
+			SetEnPassant(0);
 
 		TickForward();
 	}
 
-	void Position::Unapply(Move move)
+	void Position::Unapply(Move move, PositionHistory& history)
 	{
-		auto previous = PositionHistory::Pop();
+		auto undo = history.Pop();
+		TickBack();
 
-		castling = previous.castling;
-		bitboards = previous.bitboards;
-		enpassant = previous.enpassant;
-		fifty_counter = previous.fifty_counter;
+		auto us = ToMove();
+		auto them = ~us;
+		auto start = GetFrom(move);
+		auto finish = GetTo(move);
 
+		switch (SpecialMoveType(move))
+		{
+		case(CAPTURE_ENPASSANT):
+		{
+			auto taken = Square(us.IsWhite() ? finish - 8 : finish + 8);
+			MovePiece(us, PAWN, finish, start);
+			AddPiece(them, PAWN, taken);
+			break;
+		}
+		case(PROMOTE):
+		{
+			RemovePiece(us, PromotionPiece(move), finish);
+			AddPiece(us, PAWN, start);
+			break;
+		}
+		case(CASTLE):
+		{
+			MovePiece(us, KING, finish, start);
+			bool queenside = (finish % 8) < 4;
+			auto rook_from = Square(queenside ? finish - 2 : finish + 1);
+			auto rook_to = Square(queenside ? finish + 1 : finish - 1);
+			MovePiece(us, ROOK, rook_to, rook_from);
+			break;
+		}
+		default:
+			MovePiece(us, PieceAtSquare(finish), finish, start);
+		}
+
+		if (undo.captured != NO_PIECE)
+			AddPiece(them, Piece(undo.captured), finish);
+
+		castling = undo.castling;
+		enpassant = undo.enpassant;
+		fifty_counter = undo.fifty_counter;
+		key = undo.key;
+	}
+
+	// A null move counts towards the fifty moves like a quiet move. Its 
+	// record, with no move, stops the repetition check looking further back.
+	void Position::ApplyNull(PositionHistory& history)
+	{
+		history.Push({ 0, int8_t(NO_PIECE), int8_t(NO_PIECE), castling, fifty_counter, enpassant, key });
+		SetEnPassant(0);
+		fifty_counter++;
+		TickForward();
+	}
+
+	void Position::UnapplyNull(PositionHistory& history)
+	{
+		auto undo = history.Pop();
 		TickBack();
+		enpassant = undo.enpassant;
+		fifty_counter = undo.fifty_counter;
+		key = undo.key;
 	}
 
 	bool Position::MoveWasCapture(Move move) const
@@ -173,15 +189,7 @@ namespace Medusa
 
 	Piece Position::PieceAtSquare(Square square) const
 	{
-		auto bb = squares[square];
-		for (auto p = 0; p < NUMBER_PIECES; p++)
-		{
-			auto piece_bb = bitboards[0][p] | bitboards[1][p];
-			if ((bb & piece_bb))
-				return Piece(p);
-		}
-
-		return NO_PIECE;
+		return Piece(mailbox[square]);
 	}
 
 	Piece Position::GetAttacker(Move move) const
@@ -210,9 +218,34 @@ namespace Medusa
 		// We need to make sure this is necessary. Not sure it is.
 		position.enpassant = Medusa::Reflect(enpassant);
 		position.castling_reflect = !castling_reflect;
+		position.RebuildLookups();
 		return position;
 	}
 
+	// Occupancy, the mailbox and the key from scratch, when the bitboards
+	// are set all at once.
+	void Position::RebuildLookups()
+	{
+		mailbox.fill(int8_t(NO_PIECE));
+		key = Zobrist::castling[castling] ^ EnPassantKey(enpassant);
+		if (to_move.IsBlack())
+			key ^= Zobrist::black_to_move;
+		for (int c = 0; c < 2; c++)
+		{
+			colour_occupants[c] = 0;
+			for (int p = 0; p < NUMBER_PIECES; p++)
+			{
+				colour_occupants[c] = colour_occupants[c] | bitboards[c][p];
+				for (auto it = bitboards[c][p].begin(); it != bitboards[c][p].end(); it.operator++())
+				{
+					mailbox[*it] = int8_t(p);
+					key ^= Zobrist::pieces[c][p][*it];
+				}
+			}
+		}
+		occupancy = colour_occupants[0] | colour_occupants[1];
+	}
+
 	// is square attacked by white pieces.
 	bool Position::IsCheckmate()
 	{
@@ -224,35 +257,46 @@ namespace Medusa
 	// is square attacked by attacker pieces. Colour is attacking side.
 	bool Position::IsSquareAttacked(const Bitboard& square, Colour colour) const
 	{
-		auto occupancy = Occupants();
+		return IsSquareAttacked(BbSqr(square), colour, Occupants());
+	}
+
+	// is square attacked given the occupancy, which need not be the 
+	// current one (e.g. with the king taken off when it moves).
+	bool Position::IsSquareAttacked(Square sqr, Colour colour, Bitboard occupancy) const
+	{
 		auto bb = bitboards[colour.Index()];
 		
-		auto sqr = BbSqr(square);
 		if (knight_attacks[sqr] & bb[KNIGHT])
 			return true;
 		if (neighbours[sqr] & bb[KING])
 			return true;
-		if (DirectionAttacks(occupancy, sqr, bishop_directions) & (bb[BISHOP] | bb[QUEEN]))
+		if (PawnAttacks(~colour, sqr) & bb[PAWN])
 			return true;
-		if (DirectionAttacks(occupancy, sqr, rook_directions) & (bb[ROOK] | bb[QUEEN]))
+		if (BishopAttacks(sqr, occupancy) & (bb[BISHOP] | bb[QUEEN]))
 			return true;
-
-		bool reverse_pawn_attacks = colour.IsBlack();
-		Bitboard new_pawn_square(square);
-		if (!reverse_pawn_attacks)
-			new_pawn_square = Rotate180(new_pawn_square);
-
-		auto pawn_s = BbSqr(new_pawn_square);
-		auto pawn_bits = bb[PAWN];
-		auto attacks = pawn_attacks[pawn_s];
-		if (!reverse_pawn_attacks)
-			attacks = Rotate180(attacks);
-		if (attacks & pawn_bits)
+		if (RookAttacks(sqr, occupancy) & (bb[ROOK] | bb[QUEEN]))
 			return true;
 
 		return false;
 	}
 
+	Bitboard Position::AttackersTo(Square sqr, Bitboard occupancy) const
+	{
+		const auto& white = bitboards[Colour::WHITE.Index()];
+		const auto& black = bitboards[Colour::BLACK.Index()];
+		auto diagonal = white[BISHOP] | white[QUEEN] | black[BISHOP] | black[QUEEN];
+		auto straight = white[ROOK] | white[QUEEN] | black[ROOK] | black[QUEEN];
+
+		// A pawn attacks the squares a pawn of the other colour on them would.
+		auto attackers = (knight_attacks[sqr] & (white[KNIGHT] | black[KNIGHT]))
+			| (neighbours[sqr] & (white[KING] | black[KING]))
+			| (PawnAttacks(Colour::BLACK, sqr) & white[PAWN])
+			| (PawnAttacks(Colour::WHITE, sqr) & black[PAWN])
+			| (BishopAttacks(sqr, occupancy) & diagonal)
+			| (RookAttacks(sqr, occupancy) & straight);
+		return attackers & occupancy;
+	}
+
 	bool Position::IsInCheck() const
 	{
 		Colour us = ToMove();
@@ -264,99 +308,296 @@ namespace Medusa
 		return is_check;
 	}	
 
-	bool FilesEqual(Square x, Square y)
+	// Whether the move checks their king, directly with the piece it
+	// lands, or by clearing the line of one of our sliders. The
+	// occupancy after the move covers the special moves: the pawn taken
+	// en passant and the rook moved by castling can both uncover a line.
+	bool Position::GivesCheck(Move move) const
 	{
-		return ((x % 8) == (y % 8));
+		Colour us = ToMove();
+		auto king = bitboards[(~us).Index()][KING];
+		auto king_sqr = BbSqr(king);
+		auto special = SpecialMoveType(move);
+		auto from = GetFrom(move);
+		auto to = GetTo(move);
+		auto piece = special == PROMOTE ? PromotionPiece(move) : Piece(mailbox[from]);
+		auto bb = bitboards[us.Index()];
+		auto diagonal = (bb[BISHOP] | bb[QUEEN]) & ~squares[from];
+		auto straight = (bb[ROOK] | bb[QUEEN]) & ~squares[from];
+		auto occupancy = (Occupants() & ~squares[from]) | squares[to];
+
+		if (special == CAPTURE_ENPASSANT)
+			occupancy &= ~squares[us.IsWhite() ? to - 8 : to + 8];
+		else if (special == CASTLE)
+		{
+			bool queenside = (to % 8) < 4;
+			auto rook_from = queenside ? to - 2 : to + 1;
+			auto rook_to = queenside ? to + 1 : to - 1;
+			occupancy = (occupancy & ~squares[rook_from]) | squares[rook_to];
+			straight = (straight & ~squares[rook_from]) | squares[rook_to];
+		}
+
+		Bitboard attack;
+		switch (piece)
+		{
+		case PAWN: attack = PawnAttacks(us, to); break;
+		case KNIGHT: attack = knight_attacks[to]; break;
+		case BISHOP: attack = BishopAttacks(to, occupancy); break;
+		case ROOK: attack = RookAttacks(to, occupancy); break;
+		case QUEEN: attack = QueenAttacks(to, occupancy); break;
+		default: break;
+		}
+		if (attack & king)
+			return true;
+
+		return bool((BishopAttacks(king_sqr, occupancy) & diagonal)
+			| (RookAttacks(king_sqr, occupancy) & straight));
 	}
 
-	bool RanksEqual(Square x, Square y)
+	Bitboard Position::Checkers() const
 	{
-		return ((x / 8) == (y / 8));
+		Colour us = ToMove();
+		auto king = BbSqr(bitboards[us.Index()][KING]);
+		auto occupancy = Occupants();
+		auto bb = bitboards[(~us).Index()];
+
+		return (knight_attacks[king] & bb[KNIGHT]) |
+			(PawnAttacks(us, king) & bb[PAWN]) |
+			(BishopAttacks(king, occupancy) & (bb[BISHOP] | bb[QUEEN])) |
+			(RookAttacks(king, occupancy) & (bb[ROOK] | bb[QUEEN]));
 	}
 
-	bool DiagTo(Square a, Square b)
+	// Our pieces which are the only piece between our king and one of 
+	// their sliders.
+	Bitboard Position::Pinned(Colour colour) const
 	{
-		int dy = (a / 8) - (b / 8);
-		int dx = (a % 8) - (b % 8);
-		if (dy*dx > 0)
-			return dx == dy;
-		return false;
+		auto king = BbSqr(bitboards[colour.Index()][KING]);
+		return SliderBlockers(king, ~colour, colour);
 	}
 
-	bool AntiDiagTo(Square a, Square b)
+	// Pieces of the blockers colour which are the only piece between the
+	// king and one of the attackers sliders. For our own king these are
+	// pinned, for theirs moving them gives a discovered check.
+	Bitboard Position::SliderBlockers(Square king, Colour attackers, Colour blockers) const
 	{
-		int dy = (a / 8) - (b / 8);
-		int dx = (a % 8) - (b % 8);
-		if (dy*dx < 0)
-			return abs(dx) == abs(dy);
-		return false;
-	} 
+		auto occupancy = Occupants();
+		auto bb = bitboards[attackers.Index()];
+
+		Bitboard snipers = (RookAttacks(king, 0) & (bb[ROOK] | bb[QUEEN])) |
+			(BishopAttacks(king, 0) & (bb[BISHOP] | bb[QUEEN]));
+		Bitboard found;
+		for (auto it = snipers.begin(); it != snipers.end(); it.operator++())
+		{
+			auto between = Between(king, Square(*it)) & occupancy;
+			if (between.PopCnt() == 1)
+				found = found | (between & Occupants(blockers));
+		}
+		return found;
+	}
 
-	bool Position::AnyLegalMove()
+	LegalityMasks Position::GetLegalityMasks() const
 	{
-		auto psuedo_legal = PseudoLegalMoves<Any>();
-		bool check_d = IsInCheck();
-		auto pred = [this, check_d](Move move) {return !IsIllegalMove(move, check_d);  };
-		return std::any_of(psuedo_legal.begin(), psuedo_legal.end(), pred);
+		LegalityMasks masks;
+		masks.king = BbSqr(bitboards[to_move.Index()][KING]);
+		masks.checkers = Checkers();
+		masks.pinned = Pinned(to_move);
+
+		// In check we must take the checker or block it, in double check
+		// only the king can move.
+		masks.target = ~Occupants(to_move);
+		if (masks.checkers.PopCnt() > 1)
+			masks.target = 0;
+		else if (masks.checkers)
+			masks.target &= Between(masks.king, BbSqr(masks.checkers)) | masks.checkers;
+		return masks;
 	}
 
-	bool Position::IsIllegalMove(Move move, bool check_discovered_)
+	// Quiet moves which give check, either directly or by moving out of
+	// the way of one of our sliders. Castling checks are left out. Only
+	// used out of check, where the evasions are generated instead.
+	void Position::LegalQuietChecks(MoveList* moves, const LegalityMasks& masks) const
 	{
-		// Now filter out all illegals due to check at the end.
+		if (masks.checkers)
+			return;
+
 		Colour us = to_move;
-		Colour them = ~to_move;
+		Colour them = ~us;
+		auto bb = bitboards[us.Index()];
+		auto king = BbSqr(bitboards[them.Index()][KING]);
+		auto occupancy = Occupants();
+		auto empty = ~occupancy;
+		auto discoverers = SliderBlockers(king, us, us);
+
+		// Squares from which each piece attacks their king.
+		Bitboard checks[NUMBER_PIECES];
+		checks[KNIGHT] = knight_attacks[king];
+		checks[BISHOP] = BishopAttacks(king, occupancy);
+		checks[ROOK] = RookAttacks(king, occupancy);
+		checks[QUEEN] = checks[BISHOP] | checks[ROOK];
+		checks[KING] = 0;
+		checks[PAWN] = PawnAttacks(them, king);
+
+		for (int p = KNIGHT; p <= KING; p++)
+		{
+			auto piece = Piece(p);
+			for (auto it = bb[piece].begin(); it != bb[piece].end(); it.operator++())
+			{
+				Square from = Square(*it);
+				Bitboard attack;
+				switch (piece)
+				{
+				case KNIGHT: attack = knight_attacks[from]; break;
+				case BISHOP: attack = BishopAttacks(from, occupancy); break;
+				case ROOK: attack = RookAttacks(from, occupancy); break;
+				case QUEEN: attack = QueenAttacks(from, occupancy); break;
+				default: attack = neighbours[from]; break;
+				}
+				attack &= empty;
 
-		auto king = PieceBoard(us, KING);
-		bool check_discovered = check_discovered_;
+				// A discoverer checks unless it stays in the way.
+				if (discoverers & squares[from])
+					attack &= ~Line(king, from) | checks[piece];
+				else
+					attack &= checks[piece];
 
-		auto their_rooks = PieceBoard(them, ROOK);
-		auto their_queens = PieceBoard(them, QUEEN);
-		auto their_bishops = PieceBoard(them, BISHOP);
+				if (masks.pinned & squares[from])
+					attack &= Line(masks.king, from);
 
-		if (this->GetAttacker(move) == KING)
-			check_discovered = true;
-		else
+				for (auto it2 = attack.begin(); it2 != attack.end(); it2.operator++())
+				{
+					Square to = Square(*it2);
+					if (piece == KING && IsSquareAttacked(to, them, occupancy & ~squares[from]))
+						continue;
+					moves->emplace_back(CreateMove(from, to));
+				}
+			}
+		}
+
+		// Pushes, promotions are generated with the captures. A discoverer
+		// off the file of their king always leaves the line when pushed.
+		bool white = us.IsWhite();
+		int forward = white ? 8 : -8;
+		auto pawns = bb[PAWN] & ~ranks[white ? 6 : 1];
+		auto pawn_discoverers = pawns & discoverers & ~files[king % 8];
+		auto singles = PawnShift(pawns, us, 8) & empty;
+		auto doubles = PawnShift(singles & ranks[white ? 2 : 5], us, 8) & empty;
+		singles &= checks[PAWN] | PawnShift(pawn_discoverers, us, 8);
+		doubles &= checks[PAWN] | PawnShift(pawn_discoverers, us, 16);
+		AddPawnMoves(singles, -forward, false, masks, moves);
+		AddPawnMoves(doubles, -2 * forward, false, masks, moves);
+	}
+
+	// Whether a move of a piece other than the king lands on a target
+	// square and keeps to its pin. Used for any such piece, not only
+	// pawns, the en passant capture being the one special case.
+	bool Position::PassesLegalityMasks(Move move, const LegalityMasks& masks) const
+	{
+		auto start = GetFrom(move);
+		auto finish = GetTo(move);
+
+		// Taking en passant removes two pieces from the rank of the king
+		// so just see if the king is attacked afterwards.
+		if (SpecialMoveType(move) == CAPTURE_ENPASSANT)
+		{
+			auto them = ~to_move;
+			auto bb = bitboards[them.Index()];
+			auto taken = squares[to_move.IsWhite() ? finish - 8 : finish + 8];
+			auto occupancy = (Occupants() ^ squares[start] ^ taken) | squares[finish];
+			if (masks.checkers & ~taken & (bb[KNIGHT] | bb[PAWN]))
+				return false;
+			if (BishopAttacks(masks.king, occupancy) & (bb[BISHOP] | bb[QUEEN]))
+				return false;
+			return !(RookAttacks(masks.king, occupancy) & (bb[ROOK] | bb[QUEEN]));
+		}
+
+		if (!(squares[finish] & masks.target))
+			return false;
+		if ((squares[start] & masks.pinned) && !(squares[finish] & Line(masks.king, start)))
+			return false;
+		return true;
+	}
+
+	// Check a move which was not generated here, from the hash table or a
+	// killer slot, since it may belong to a different position entirely.
+	bool Position::IsLegal(Move move, const LegalityMasks& masks) const
+	{
+		auto start = GetFrom(move);
+		auto finish = GetTo(move);
+		auto special = SpecialMoveType(move);
+		auto ours = Occupants(to_move);
+		if (!(ours & squares[start]) || (ours & squares[finish]))
+			return false;
+
+		// Only promotions carry a piece.
+		if (special != PROMOTE && PromotionPiece(move) != KNIGHT)
+			return false;
+
+		// Rare enough to just compare with the generated moves.
+		if (special == CASTLE || special == CAPTURE_ENPASSANT)
+		{
+			MoveList moves;
+			LegalMoves<Any>(&moves, masks);
+			return std::find(moves.begin(), moves.end(), move) != moves.end();
+		}
+
+		auto piece = PieceAtSquare(start);
+		auto occupancy = Occupants();
+		auto theirs = Occupants(~to_move);
+		if (piece == PAWN)
 		{
-			auto kingsq = BbSqr(king);
-			auto start = GetFrom(move);
-			auto finish = GetTo(move);
-			int fidx = kingsq % 8;
-			int ridx = kingsq / 8;
-			if (FilesEqual(kingsq, start) && !FilesEqual(start, finish))
+			bool white = to_move.IsWhite();
+			int forward = white ? 8 : -8;
+			bool last_rank = bool(squares[finish] & ranks[white ? 7 : 0]);
+			if (last_rank != (special == PROMOTE))
+				return false;
+
+			if (PawnAttacks(to_move, start) & squares[finish])
 			{
-				auto kingfile = files[fidx];
-				if (((their_rooks | their_queens) & kingfile))
-					check_discovered = true;
+				if (!(theirs & squares[finish]))
+					return false;
 			}
-			if (RanksEqual(kingsq, start) && !RanksEqual(start, finish))
+			else if (finish == start + forward)
 			{
-				auto kingrank = ranks[ridx];
-				if (((their_rooks | their_queens) & kingrank))
-					check_discovered = true;
+				if (occupancy & squares[finish])
+					return false;
 			}
-			if (DiagTo(kingsq, start) && !DiagTo(start, finish))
+			else if (finish == start + 2 * forward && (squares[start] & ranks[white ? 1 : 6]))
 			{
-				auto kingdiag = diagonals[kingsq];
-				if (((their_bishops | their_queens) & kingdiag))
-					check_discovered = true;
+				if (occupancy & (squares[finish] | squares[start + forward]))
+					return false;
 			}
-			if (AntiDiagTo(kingsq, start) && !AntiDiagTo(start, finish))
+			else
+				return false;
+		}
+		else
+		{
+			if (special == PROMOTE)
+				return false;
+
+			Bitboard attacks;
+			switch (piece)
 			{
-				auto kingdiag = antidiagonals[kingsq];
-				if (((their_bishops | their_queens) & kingdiag))
-					check_discovered = true;
+			case KNIGHT: attacks = knight_attacks[start]; break;
+			case BISHOP: attacks = BishopAttacks(start, occupancy); break;
+			case ROOK: attacks = RookAttacks(start, occupancy); break;
+			case QUEEN: attacks = QueenAttacks(start, occupancy); break;
+			default: attacks = neighbours[start]; break;
 			}
+			if (!(attacks & squares[finish]))
+				return false;
 		}
 
-		if (check_discovered)
-		{
-			Apply(move);
-			auto king = this->bitboards[us.Index()][KING];
-			bool discovered_check = this->IsSquareAttacked(king, them);
-			Unapply(move);
-			return discovered_check;
-		}
+		if (piece == KING)
+			return !IsSquareAttacked(finish, ~to_move, occupancy & ~squares[start]);
 
-		return false;
-	};
+		// In double check only the king can move.
+		if (masks.checkers.PopCnt() > 1)
+			return false;
+		return PassesLegalityMasks(move, masks);
+	}
+
+	bool Position::AnyLegalMove() const
+	{
+		return !LegalMoves<Any>().empty();
+	}
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef position_h
 #define position_h
 
+#include <algorithm>
 #include <array>
 #include <functional>
 #include <memory>
@@ -8,16 +9,124 @@
 #include <set>
 #include <iostream>
 
+#include "attacks.h"
 #include "bitboard.h"
 #include "board.h"
+#include "movelist.h"
 #include "types.h"
+#include "zobrist.h"
 
 namespace Medusa {
 
 	enum MoveType
 	{
 		Any = 0,
+		// Captures and promotions
 		Capture = 1,
+		// Everything else
+		Quiet = 2,
+	};
+
+	// Worked out once per node so that the generators only emit legal moves.
+	struct LegalityMasks
+	{
+		// Our king square
+		Square king;
+		// Their pieces giving check
+		Bitboard checkers;
+		// Our pieces pinned to our king
+		Bitboard pinned;
+		// Squares a piece other than the king may move to
+		Bitboard target;
+	};
+
+	// What Unapply needs to take a move back, everything else follows 
+	// from the move itself. The key of the position before the move is 
+	// kept for spotting repetitions, and the piece moved for ordering
+	// moves by what came before them.
+	struct UndoInfo
+	{
+		Move move;
+		int8_t piece;
+		int8_t captured;
+		Castling castling;
+		unsigned short fifty_counter;
+		Bitboard enpassant;
+		uint64_t key;
+	};
+
+	// The moves which led to a position, starting with the game moves.
+	// Kept apart from the position and handed to Apply and Unapply, so
+	// that a copy of a position is only the board. The game, each search
+	// and each perft worker own one.
+	class PositionHistory
+	{
+	public:
+		// Enough for a long game, so the stack never has to grow.
+		static constexpr size_t reserved_plies = 1024;
+
+		void Clear()
+		{
+			stack.clear();
+		}
+
+		void Push(const UndoInfo& undo)
+		{
+			if (stack.capacity() < reserved_plies)
+				stack.reserve(reserved_plies);
+			stack.push_back(undo);
+		}
+
+		UndoInfo Pop()
+		{
+			UndoInfo ret = stack.back();
+			stack.pop_back();
+			return ret;
+		}
+
+		// Was a piece moved to this square by the side to move, last turn?
+		bool LastMoved(Square square) const
+		{
+			int idx = int(stack.size()) - 2;
+			if (idx < 0 || !stack[idx].move)
+				return false;
+			return GetTo(stack[idx].move) == square;
+		}
+
+		// The record of the move so many plies back (1 is the last move),
+		// null if the history does not go back that far.
+		const UndoInfo* Back(int plies) const
+		{
+			int idx = int(stack.size()) - plies;
+			return idx >= 0 ? &stack[idx] : nullptr;
+		}
+
+		// Was the last move a null move?
+		bool LastWasNull() const
+		{
+			return !stack.empty() && !stack.back().move;
+		}
+
+		// Has the position with this key come up twice before? Only 
+		// positions with the same side to move, and since the last capture
+		// or pawn move, can be the same. A null move is not a move of the
+		// game, so nothing before one counts either.
+		bool HaveBeenThreeRepetitions(uint64_t key, int fifty_counter) const
+		{
+			int reps = 1;
+			int last = std::max(int(stack.size()) - fifty_counter, 0);
+			for (int idx = int(stack.size()) - 2; idx >= last && reps < 3; idx -= 2)
+			{
+				if (!stack[idx + 1].move || !stack[idx].move)
+					break;
+				if (stack[idx].key == key)
+					reps++;
+			}
+			return reps >= 3;	
+		}
+
+	private:
+		std::vector<UndoInfo> stack;
 	};
 
 	class Position
@@ -30,6 +139,8 @@ namespace Medusa {
 			plies = 0;
 			castling = Castling::ALL;
 			castling_reflect = false;
+			mailbox.fill(int8_t(NO_PIECE));
+			key = Zobrist::castling[castling];
 		}
 
 		Position(
@@ -49,15 +160,22 @@ namespace Medusa {
 			to_move(to_move_),
 			castling_reflect(castling_reflect_)
 		{
+			RebuildLookups();
 		}
 
-		void Apply(Move move);
-		void Unapply(Move move);
+		void Apply(Move move, PositionHistory& history);
+		void Unapply(Move move, PositionHistory& history);
+
+		// Pass the move to the other side, for null move pruning. Must not
+		// be used in check.
+		void ApplyNull(PositionHistory& history);
+		void UnapplyNull(PositionHistory& history);
+
 		void PrettyPrint() const;
 
 		Bitboard Occupants() const
 		{
-			return Occupants(Colour::WHITE) | Occupants(Colour::BLACK);
+			return occupancy;
 		}
 
 		Bitboard Occupants(Colour colour) const
@@ -68,15 +186,7 @@ namespace Medusa {
 
 		Bitboard Occupants(int index) const
 		{
-			auto coloured_occupants_bitboards = bitboards[index];
-			Bitboard ret(0);
-
-			for (int i = 0; i < Piece::NUMBER_PIECES; ++i)
-			{
-				ret = ret | coloured_occupants_bitboards[i];
-			}
-
-			return ret;
+			return colour_occupants[index];
 		}
 
 		Position Reflect() const;
@@ -94,6 +204,11 @@ namespace Medusa {
 
 			piece_bitboard = BitMove(piece_bitboard, start, finish);
 			bitboards[index][piece] = piece_bitboard;
+			colour_occupants[index] = BitMove(colour_occupants[index], start, finish);
+			occupancy = colour_occupants[0] | colour_occupants[1];
+			mailbox[finish] = int8_t(piece);
+			mailbox[start] = int8_t(NO_PIECE);
+			key ^= Zobrist::pieces[index][piece][start] ^ Zobrist::pieces[index][piece][finish];
 		}
 
 		void AddPiece(Colour colour, Piece piece, Square square)
@@ -101,6 +216,10 @@ namespace Medusa {
 			int index = colour.Index();
 			auto piece_bitboard = OnBit(bitboards[index][piece], square);
 			bitboards[index][piece] = piece_bitboard;
+			colour_occupants[index] = colour_occupants[index] | squares[square];
+			occupancy = occupancy | squares[square];
+			mailbox[square] = int8_t(piece);
+			key ^= Zobrist::pieces[index][piece][square];
 		}
 
 		void RemovePiece(Colour colour, Piece piece, Square square)
@@ -108,6 +227,10 @@ namespace Medusa {
 			int index = colour.Index();
 			auto piece_bitboard = OffBit(bitboards[index][piece], square);
 			bitboards[index][piece] = piece_bitboard;
+			colour_occupants[index] = colour_occupants[index] & ~squares[square];
+			occupancy = colour_occupants[0] | colour_occupants[1];
+			mailbox[square] = int8_t(NO_PIECE);
+			key ^= Zobrist::pieces[index][piece][square];
 		}
 
 		unsigned short GetFiftyCounter() const { return fifty_counter; }
@@ -120,10 +243,18 @@ namespace Medusa {
 				c = static_cast<Castling>((c % 4 << 2) + (c / 4));
 			return c;
 		}
-		void SetCastling(Castling castling_) { castling = castling_; }
+		void SetCastling(Castling castling_)
+		{
+			key ^= Zobrist::castling[castling] ^ Zobrist::castling[castling_];
+			castling = castling_;
+		}
 		void SetFiftyCounter(short fifty_counter_) { fifty_counter = fifty_counter_; }
-		void SetEnPassant(Bitboard enpassant_) { enpassant = enpassant_; }
-		void ApplyUCI(std::string move_str);
+		void SetEnPassant(Bitboard enpassant_)
+		{
+			key ^= EnPassantKey(enpassant) ^ EnPassantKey(enpassant_);
+			enpassant = enpassant_;
+		}
+		void ApplyUCI(std::string move_str, PositionHistory& history);
 		Piece PieceAtSquare(Square square) const;
 		bool MoveIsCapture(Move move) const;
 		Piece GetAttacker(Move move) const;
@@ -136,6 +267,7 @@ namespace Medusa {
 		)
 		{
 			to_move = ~to_move;
+			key ^= Zobrist::black_to_move;
 			plies++;
 #ifdef _DEBUG
 			//past_moves.push_back(move_str);
@@ -146,6 +278,7 @@ namespace Medusa {
 		void TickBack()
 		{
 			to_move = ~to_move;
+			key ^= Zobrist::black_to_move;
 			plies--;
 		}
 
@@ -164,7 +297,7 @@ namespace Medusa {
 
 		void DisableCastling(Castling castle_disable)
 		{
-			castling = static_cast<Castling>(castling & ~castle_disable);
+			SetCastling(static_cast<Castling>(castling & ~castle_disable));
 		}
 
 		Colour ToMove() const
@@ -172,9 +305,8 @@ namespace Medusa {
 			return to_move;
 		}
 
-		bool ThreeMoveRepetition() const;
-
-		bool LastMoved(Piece piece, Square square) const;
+		// Zobrist key, kept up to date as the position changes.
+		uint64_t Key() const { return key; }
 
 		bool operator==(const Position& other) const {
 			bool equal = true;
@@ -188,17 +320,26 @@ namespace Medusa {
 		bool operator!=(const Position& other) const { return !operator==(other); }
 
 		template <MoveType MT>
-		std::vector<Move> LegalMoves()
+		MoveList LegalMoves() const
 		{
-			auto psuedo_legal = PseudoLegalMoves<MT>();
-			bool check_d = IsInCheck();
-			auto pred = [this, check_d](Move move) {return this->IsIllegalMove(move, check_d);  };
-			auto to_remove = std::remove_if(psuedo_legal.begin(), psuedo_legal.end(), pred);
-			psuedo_legal.erase(to_remove, psuedo_legal.end());
-			return psuedo_legal;
+			MoveList moves;
+			LegalMoves<MT>(&moves);
+			return moves;
 		}
 
-		bool AnyLegalMove();
+		template <MoveType MT>
+		void LegalMoves(MoveList* moves) const
+		{
+			LegalMoves<MT>(moves, GetLegalityMasks());
+		}
+
+		template <MoveType MT>
+		void LegalMoves(MoveList* moves, const LegalityMasks& masks) const;
+
+		template <MoveType MT>
+		void LegalEvasions(MoveList* moves, const LegalityMasks& masks) const;
+
+		bool AnyLegalMove() const;
 
 		Bitboard PieceBoard(Colour colour, Piece piece) const
 		{
@@ -212,40 +353,80 @@ namespace Medusa {
 			return bitboards[index][piece];
 		}
 
-		template <MoveType MT>
-		std::vector<Move> PseudoLegalMoves();
-		bool IsIllegalMove(Move move, bool check_discovered_);
+		LegalityMasks GetLegalityMasks() const;
+		Bitboard Checkers() const;
+		Bitboard Pinned(Colour colour) const;
+		Bitboard SliderBlockers(Square king, Colour attackers, Colour blockers) const;
+
+		void LegalQuietChecks(MoveList* moves, const LegalityMasks& masks) const;
 
 		template <Piece piece, MoveType MT>
 		void LegalJumperMoves(
 			Colour us,
 			const Bitboard* attacks,
-			std::vector<Move>* moves) const;
+			const LegalityMasks& masks,
+			MoveList* moves) const;
 
 		template <Piece piece, MoveType MT>
 		void LegalSliderMoves(
 			Colour us,
-			const std::pair<int, int>* directions,
-			std::vector<Move>* moves) const;
+			const LegalityMasks& masks,
+			MoveList* moves) const;
+
+		template <MoveType MT>
+		void LegalKingMoves(
+			Colour us,
+			const LegalityMasks& masks,
+			MoveList* moves) const;
 
 		template <MoveType MT>
 		void LegalPawnMoves(
 			Colour colour, 
-			std::vector<Move>* moves) const;
+			const LegalityMasks& masks,
+			MoveList* moves) const;
 
 		template <MoveType MT>
 		void LegalCastlingMoves(
 			Colour colour, 
-			std::vector<Move>* moves) const;
+			MoveList* moves) const;
+
+		bool PassesLegalityMasks(Move move, const LegalityMasks& masks) const;
+		bool IsLegal(Move move, const LegalityMasks& masks) const;
 
 		bool IsSquareAttacked(const Bitboard& square, Colour colour) const;
+		bool IsSquareAttacked(Square square, Colour colour, Bitboard occupancy) const;
+
+		// Pieces of either colour attacking a square, among the given
+		// occupancy. Taking pieces off the occupancy reveals the sliders
+		// behind them.
+		Bitboard AttackersTo(Square square, Bitboard occupancy) const;
 
-		void set_colour(Colour colour) { to_move = colour; }
+		void set_colour(Colour colour)
+		{
+			if (colour.Index() != to_move.Index())
+				key ^= Zobrist::black_to_move;
+			to_move = colour;
+		}
 		bool IsInCheck() const;
+		bool GivesCheck(Move move) const;
 		bool IsCheckmate();
 		
 	private:
+		void RebuildLookups();
+
+		static uint64_t EnPassantKey(Bitboard enpassant)
+		{
+			return enpassant ? Zobrist::enpassant[BbSqr(enpassant) % 8] : 0;
+		}
+
 		std::array<std::array<Bitboard, 6>, 2> bitboards;
+		// Kept up to date with the bitboards, they are asked for so often.
+		std::array<Bitboard, 2> colour_occupants;
+		Bitboard occupancy;
+		uint64_t key;
+		// Piece on each square, or NO_PIECE, for lookups by square. Bytes
+		// to keep the position small to copy.
+		std::array<int8_t, 64> mailbox;
 		Castling castling;
 		unsigned short fifty_counter;
 		unsigned short plies;
@@ -258,273 +439,242 @@ namespace Medusa {
 		mutable bool castling_reflect;
 	};
 
-	class PositionHistory
-	{
-	public:
-		static std::vector<Position> history;
-
-		static void Clear()
-		{
-			history.clear();
-		}
-
-		static void Push(const Position& position)
-		{
-			history.emplace_back(position);
-		}
-
-		// Was this piece moved to this square in the last move?
-		static bool LastMoved(Piece piece, Square square)
-		{
-			// Get the index of the history 2 plies ago.
-			int idx = history.size() - 3;
-			if (idx < 0)
-				return false;
-
-			// Get the piece bitboard from 4 plies ago.
-			auto to_move = history.back().ToMove();
-			auto piecebb = history[idx].PieceBoard(to_move, piece);
-
-			// If we don't have the piece here then we moved it.
-			return !(piecebb & SqrBb(square));
-		}
 
-		static Position Pop()
-		{
-			Position ret = history.back();
-			history.pop_back();
-			return ret;
-		}
-
-		static bool HaveBeenThreeRepetitions()
+	template <MoveType MT>
+	inline void Position::LegalMoves(MoveList* moves, const LegalityMasks& masks) const
+	{
+		if (masks.checkers)
 		{
-			int idx = history.size() - 3;
-			if (idx < 2)
-				return false;
-
-			const auto& last = history.back();
-			
-			// Is only a draw on the last position, can only be 
-			// the same position if its the same players turn.
-			int reps = 1;
-			do 
-			{
-				if (history[idx] == last)
-					reps++;
-				idx = idx - 2;
-			} while (idx > 0 && reps < 3);
-
-			return reps >= 3;	
+			LegalEvasions<MT>(moves, masks);
+			return;
 		}
-	};
 
-	inline bool Position::LastMoved(Piece piece, Square square) const
-	{
-		// 2 plies ago was the piece still on this square?
-		return PositionHistory::LastMoved(piece, square);
-	}
-
-	inline bool Position::ThreeMoveRepetition() const
-	{
-		return PositionHistory::HaveBeenThreeRepetitions();
+		Colour us = to_move;
+		LegalPawnMoves<MT>(us, masks, moves);
+		LegalJumperMoves<KNIGHT, MT>(us, knight_attacks, masks, moves);
+		LegalSliderMoves<ROOK, MT>(us, masks, moves);
+		LegalSliderMoves<BISHOP, MT>(us, masks, moves);
+		LegalSliderMoves<QUEEN, MT>(us, masks, moves);
+		LegalCastlingMoves<MT>(us, moves);
+		LegalKingMoves<MT>(us, masks, moves);
 	}
 
-
+	// Moves out of check: the king steps to a safe square, or (in single
+	// check) the checker is taken or a piece is put in between. There are
+	// only a few target squares so look for the pieces which reach them,
+	// rather than going through all of our pieces.
 	template <MoveType MT>
-	inline std::vector<Move> Position::PseudoLegalMoves()
+	inline void Position::LegalEvasions(MoveList* moves, const LegalityMasks& masks) const
 	{
 		Colour us = to_move;
-		std::vector<Move> *moves(new std::vector<Move>());
-
-		// There are not going to be more than 64 legal moves in a standard game.
-		moves->reserve(64);
-
-		// Must do this first.
-		LegalPawnMoves<MT>(us, moves);
+		LegalKingMoves<MT>(us, masks, moves);
+		if (masks.checkers.PopCnt() > 1)
+			return;
 
-		// Add all moves
-		LegalJumperMoves<KNIGHT, MT>(us, knight_attacks, moves);
-		LegalJumperMoves<KING, MT>(us, neighbours, moves);
-		LegalSliderMoves<ROOK, MT>(us, rook_directions, moves);
-		LegalSliderMoves<BISHOP, MT>(us, bishop_directions, moves);
-		LegalSliderMoves<QUEEN, MT>(us, bishop_directions, moves);
-		LegalSliderMoves<QUEEN, MT>(us, rook_directions, moves);
-		LegalCastlingMoves<MT>(us, moves);
+		// Pawns already keep to the target squares.
+		LegalPawnMoves<MT>(us, masks, moves);
 
-		return (*moves);
+		Bitboard target = masks.target;
+		if (MT == Capture)
+			target &= masks.checkers;
+		if (MT == Quiet)
+			target &= ~masks.checkers;
+
+		// A pinned piece can never get out of a check from another piece.
+		auto bb = bitboards[us.Index()];
+		auto occupancy = Occupants();
+		auto free = ~masks.pinned;
+		for (auto it = target.begin(); it != target.end(); it.operator++())
+		{
+			Square sqr = Square(*it);
+			auto defenders = (knight_attacks[sqr] & bb[KNIGHT]) |
+				(BishopAttacks(sqr, occupancy) & (bb[BISHOP] | bb[QUEEN])) |
+				(RookAttacks(sqr, occupancy) & (bb[ROOK] | bb[QUEEN]));
+			defenders &= free;
+			for (auto it2 = defenders.begin(); it2 != defenders.end(); it2.operator++())
+				moves->emplace_back(CreateMove(Square(*it2), sqr));
+		}
 	}
 	
 	template <Piece piece, MoveType MT>
 	inline void Position::LegalJumperMoves(
 		Colour us,
 		const Bitboard* attacks,
-		std::vector<Move>* moves) const
+		const LegalityMasks& masks,
+		MoveList* moves) const
 	{
-		Bitboard piecebb = bitboards[us.Index()][piece];
-		Bitboard ours = Occupants(us);
-		Bitboard theirs = Occupants(~us);
+		// A pinned jumper can never move along the pin.
+		Bitboard piecebb = bitboards[us.Index()][piece] & ~masks.pinned;
+		Bitboard target = masks.target;
+		if (MT == Capture)
+			target &= Occupants(~us);
+		if (MT == Quiet)
+			target &= ~Occupants(~us);
 		for (auto it = piecebb.begin(); it != piecebb.end(); it.operator++())
 		{
 			Square sqr = Square(*it);
-			;			Bitboard square = squares[sqr];
-			auto attack = attacks[sqr] & (~ours);
-			if (MT == Capture)
-				attack &= theirs;
+			auto attack = attacks[sqr] & target;
 			for (auto it2 = attack.begin(); it2 != attack.end(); it2.operator++())
 			{
-				Square sqr2 = Square(*it2);
-				auto move = CreateMove(Square(sqr), Square(sqr2));
+				auto move = CreateMove(sqr, Square(*it2));
 				moves->emplace_back(move);
 			}
 		}
 	}
 
+	template <MoveType MT>
+	inline void Position::LegalKingMoves(
+		Colour us,
+		const LegalityMasks& masks,
+		MoveList* moves) const
+	{
+		Colour them = ~us;
+		auto attack = neighbours[masks.king] & ~Occupants(us);
+		if (MT == Capture)
+			attack &= Occupants(them);
+		if (MT == Quiet)
+			attack &= ~Occupants(them);
+
+		// The king must not hide behind itself from a slider.
+		auto occupancy = Occupants() & ~squares[masks.king];
+		for (auto it = attack.begin(); it != attack.end(); it.operator++())
+		{
+			Square sqr = Square(*it);
+			if (!IsSquareAttacked(sqr, them, occupancy))
+				moves->emplace_back(CreateMove(masks.king, sqr));
+		}
+	}
+
 	template <Piece piece, MoveType MT>
 	inline void Position::LegalSliderMoves(
 		Colour us, 
-		const std::pair<int, int>* directions, 
-		std::vector<Move>* moves) const
+		const LegalityMasks& masks,
+		MoveList* moves) const
 	{
 		Colour them = ~us;
 		Bitboard piecebb = bitboards[us.Index()][piece];
 		Bitboard theirs = Occupants(them);
-		Bitboard ours = Occupants(us);
+		Bitboard occupants = Occupants(us) | theirs;
+		Bitboard target = masks.target;
+		if (MT == Capture)
+			target &= theirs;
+		if (MT == Quiet)
+			target &= ~theirs;
 
 		for (auto it = piecebb.begin(); it != piecebb.end(); it.operator++())
 		{
 			Square sqr = Square(*it);
-			Bitboard square = squares[sqr];
+			auto attack = SliderAttacks<piece>(sqr, occupants) & target;
 
-			for (int i = 0; i < 4; i++)
+			// A pinned slider may only move along the pin.
+			if (masks.pinned & squares[sqr])
+				attack &= Line(masks.king, sqr);
+			for (auto it2 = attack.begin(); it2 != attack.end(); it2.operator++())
 			{
-				auto dir = directions[i];
-				int sidx = sqr;
-				while (true)
-				{
-					int rank = sidx / 8;
-					if (dir.first > 0 && rank == 7)
-						break;
-					if (dir.first < 0 && rank == 0)
-						break;
-					int file = sidx % 8;
-					if (dir.second > 0 && file == 7)
-						break;
-					if (dir.second < 0 && file == 0)
-						break;
-
-					sidx += 8 * dir.first + dir.second;
-					if (sidx > 63 | sidx < 0)
-						break;
-					Bitboard new_bb = squares[sidx];
-					if (new_bb&ours)
-						break;
-					auto sqrto = Square(sidx);
-
-					// Skip non-captures.
-					auto move = CreateMove(Square(sqr), Square(sidx));
-					if (MT == Capture && !(theirs & squares[sidx]))
-						continue;
+				auto move = CreateMove(sqr, Square(*it2));
+				moves->emplace_back(move);
+			}
+		}
+	}
 
-					moves->emplace_back(move);
-					if (new_bb&theirs)
-						break;
-				}
+	// Shift a bitboard towards the opponent's side, for pawn moves.
+	inline Bitboard PawnShift(Bitboard bb, Colour colour, int shift)
+	{
+		return colour.IsWhite() ? (bb << shift) : (bb >> shift);
+	}
+
+	// Add a pawn move to each of the destinations, the pawns are found by
+	// stepping back. Pinned pawns may only move along the pin.
+	inline void AddPawnMoves(
+		Bitboard destinations,
+		int step_back,
+		bool promote,
+		const LegalityMasks& masks,
+		MoveList* moves)
+	{
+		for (auto it = destinations.begin(); it != destinations.end(); it.operator++())
+		{
+			auto to = Square(*it);
+			auto from = Square(*it + step_back);
+			if ((masks.pinned & squares[from]) && !(Line(masks.king, from) & squares[to]))
+				continue;
+
+			if (promote)
+			{
+				moves->emplace_back(CreatePromotion(from, to, QUEEN));
+				moves->emplace_back(CreatePromotion(from, to, KNIGHT));
+				moves->emplace_back(CreatePromotion(from, to, ROOK));
+				moves->emplace_back(CreatePromotion(from, to, BISHOP));
 			}
+			else
+				moves->emplace_back(CreateMove(from, to));
 		}
 	}
 
 	template <MoveType MT>
 	inline void Position::LegalPawnMoves(
 		Colour colour, 
-		std::vector<Move>* moves) const
+		const LegalityMasks& masks,
+		MoveList* moves) const
 	{
-		// Work out on the pawn moves based on the reflected position.
-		Position context(*this);
-		if (colour.IsBlack())
-			context = context.Reflect();
-
-		// Promote pieces
-		const Piece promote_pieces[] = {
-			KNIGHT,
-			BISHOP,
-			ROOK,
-			QUEEN
-		};
-
-		// Get the position information from the potentially reflected position.
-		Bitboard pawns = context.bitboards[colour.Index()][PAWN];
-		Bitboard occ = context.Occupants();
-		Bitboard bocc = context.Occupants(~colour);
-
-		for (auto it = pawns.begin(); it != pawns.end(); it.operator++())
-		{
-			auto sqr = Square(*it);
-			int rank = sqr / 8;
-			Bitboard square = squares[sqr];
-
-			// Pushes
-			Bitboard push_once = square << 8;
-			if (!(push_once & occ) && MT != Capture)
+		// Pawns are moved all at once by shifting the bitboard. Shifting the
+		// destinations back by the same amount gives the starting squares.
+		bool white = colour.IsWhite();
+		int forward = white ? 8 : -8;
+		int diagonal = white ? 7 : -7;
+		int antidiagonal = white ? 9 : -9;
+
+		Bitboard pawns = bitboards[colour.Index()][PAWN];
+		Bitboard empty = ~Occupants();
+		Bitboard theirs = Occupants(~colour) & masks.target;
+		Bitboard seventh = ranks[white ? 6 : 1];
+		Bitboard third = ranks[white ? 2 : 5];
+
+		for (bool promote : { true, false })
+		{
+			Bitboard movers = pawns & (promote ? seventh : ~seventh);
+			if (!movers)
+				continue;
+
+			// Captures, a shift by 7 goes towards the a file for white (and the
+			// h file for black) so must not wrap around onto the other edge.
+			if (MT != Quiet)
 			{
-				if (rank == 1) // 2nd rank, double push.
-				{
-					Bitboard push_twice = square << 16;
-					if (!(push_twice & occ))
-						moves->emplace_back(CreateMove(sqr, Square(sqr + 16)));
-				}
-				if (rank == 6) // 7th rank, promotion
-					for (auto& prom : promote_pieces)
-						moves->emplace_back(CreatePromotion(sqr, Square(sqr + 8), prom));
-				else
-					moves->emplace_back(CreateMove(sqr, Square(sqr + 8)));
+				auto diagonals = PawnShift(movers, colour, 7) & ~files[white ? 7 : 0] & theirs;
+				auto antidiagonals = PawnShift(movers, colour, 9) & ~files[white ? 0 : 7] & theirs;
+				AddPawnMoves(diagonals, -diagonal, promote, masks, moves);
+				AddPawnMoves(antidiagonals, -antidiagonal, promote, masks, moves);
 			}
 
-			// Captures
-			if (pawn_attacks[sqr] & (bocc | context.enpassant))
-				for (int shft : {7, 9})
-				{
-					// You cannot capture off the side of the board.
-					int file = sqr % 8;
-					if (file == 0 && shft == 7)
-						continue;
-					if (file == 7 && shft == 9)
-						continue;
-
-					Bitboard capt_diag = square << shft;
-					Square to = Square(sqr + shft);
-					if (capt_diag & (bocc | context.enpassant))
-					{
-						if (rank == 6) // 7th rank, promotion
-							for (auto& prom : promote_pieces)
-								moves->emplace_back(CreatePromotion(sqr, to, prom));
-						else
-						{
-							// Taking enpassant
-							if (pawn_attacks[sqr] & context.enpassant)
-								moves->emplace_back(CreateEnPassant(sqr, to));
-							else
-								moves->emplace_back(CreateMove(sqr, to));
-						}
-					}
-				}
+			// Pushing to promote counts with the captures.
+			if ((MT == Capture && !promote) || (MT == Quiet && promote))
+				continue;
+
+			// Single and double pushes
+			auto singles = PawnShift(movers, colour, 8) & empty;
+			auto doubles = PawnShift(singles & third, colour, 8) & empty & masks.target;
+			AddPawnMoves(singles & masks.target, -forward, promote, masks, moves);
+			AddPawnMoves(doubles, -2 * forward, false, masks, moves);
 		}
 
-		// Generate moves on the reflected position for convenience, so return
-		// the reflected moves to be correct.
-		if (colour.IsBlack())
+		// Taking en passant, checked on its own since it lifts two pawns.
+		if (MT != Quiet && enpassant)
 		{
-			std::transform(
-				moves->begin(),
-				moves->end(),
-				moves->begin(),
-				[](Move move) { return ReflectMove(move); });
+			auto to = BbSqr(enpassant);
+			auto takers = PawnAttacks(~colour, to) & pawns;
+			for (auto it = takers.begin(); it != takers.end(); it.operator++())
+			{
+				auto move = CreateEnPassant(Square(*it), to);
+				if (PassesLegalityMasks(move, masks))
+					moves->emplace_back(move);
+			}
 		}
 	}
 
 	template <MoveType MT>
 	inline void Position::LegalCastlingMoves(
 		Colour colour, 
-		std::vector<Move>* moves) const
+		MoveList* moves) const
 	{
 		if (MT == Capture)
 			return;
@@ -537,11 +687,8 @@ namespace Medusa {
 
 		auto queenside = black ? B_QUEENSIDE : W_QUEENSIDE;
 		auto kingside = black ? B_KINGSIDE : W_KINGSIDE;
-		bool reverse_pawn_attacks = !black;
-		bool checked = IsInCheck();
-
 		// queenside castling
-		if (bool(castling & queenside) && !checked)
+		if (bool(castling & queenside))
 		{
 			auto near_square = squares[black ? d8 : d1];
 			auto extra_square = squares[black ? b8 : b1];
@@ -561,7 +708,7 @@ namespace Medusa {
 		}
 
 		// kingside castling
-		if (bool(castling & kingside) && !checked)
+		if (bool(castling & kingside))
 		{
 			auto near_square = squares[black ? f8 : f1];
 			auto far_square = squares[black ? g8 : g1];
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <ctime>
 #include <functional>
 
@@ -10,74 +12,251 @@
 
 namespace Medusa {
 
-bool Search::searching_flag = true;
-
-size_t Search::Perft(Position &position, size_t max_depth)
+size_t Search::Perft(Position &position, PositionHistory& history, size_t max_depth)
 {
-	/// Counts the number of nodes, currently turned off, it probably 
-	/// will only work well if we have a hash table of positions otherwise
-	/// it greedily recounts all of the legal moves which takes up too much
-	/// resource.
-	return 0;
+	/// Counts the leaf nodes of the tree of legal moves. The generated
+	/// moves are all legal so the last ply is counted by the size of the
+	/// move list, without making any of them.
 	if (max_depth == 0)
 		return 1;
+	MoveList legals;
+	position.LegalMoves<Any>(&legals);
+	if (max_depth == 1)
+		return legals.size();
+
 	size_t nodes = 0;
-	auto pseudo_legals = position.PseudoLegalMoves<Any>();
-	for (auto m : pseudo_legals)
+	for (auto m : legals)
 	{
-		position.Apply(m);
-		if (!position.IsInCheck())
-			nodes += Perft(position, max_depth - 1);
-		position.Unapply(m);
+		position.Apply(m, history);
+		nodes += Perft(position, history, max_depth - 1);
+		position.Unapply(m, history);
 	}
 	return nodes;
 }
 
-std::shared_ptr<Variation> Search::SearchRoot(Position &position_, int max_depth_)
+PerftInfo Search::Divide(Position &position, size_t max_depth, bool divide)
+{
+	/// Perft keeping the count under each root move, for finding 
+	/// which move a generator bug is under, and timing it.
+	PerftInfo info;
+	auto start = std::chrono::steady_clock::now();
+	if (max_depth == 0)
+		info.nodes = 1;
+	else
+	{
+		PositionHistory history;
+		MoveList legals;
+		position.LegalMoves<Any>(&legals);
+		for (auto m : legals)
+		{
+			position.Apply(m, history);
+			auto nodes = Perft(position, history, max_depth - 1);
+			position.Unapply(m, history);
+			if (divide)
+				info.divide.emplace_back(m, nodes);
+			info.nodes += nodes;
+		}
+	}
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	info.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+	return info;
+}
+
+std::shared_ptr<Variation> Search::SearchRoot(
+	Position &position_,
+	const PositionHistory& history_,
+	const SearchLimits& limits_)
 {
-	auto vrtn = IterWindowSearch(position_, max_depth_);
+	position_history = history_;
+	auto vrtn = IterWindowSearch(position_, limits_);
 	return vrtn;
 }
 
+// Nodes between looks at the clock.
+static const size_t time_check_nodes = 1024;
+
+void Search::CountNode()
+{
+	nodes++;
+	if (limits.nodes && nodes >= limits.nodes)
+		limit_reached = true;
+	if (limits.hard_time_ms && nodes % time_check_nodes == 0)
+	{
+		auto elapsed = std::chrono::steady_clock::now() - limits.start;
+		if (std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() >= limits.hard_time_ms)
+			limit_reached = true;
+	}
+}
+
+// Half width of the first aspiration window in centipawns, it doubles on
+// each failure until it is too wide to be worth having.
+static const int aspiration_window = 25;
+static const int max_aspiration_window = 400;
+
 std::shared_ptr<Variation> Search::IterWindowSearch(
 	Position &position_,
-	int max_depth_
+	const SearchLimits& limits_
 )
 {
-	std::shared_ptr<Variation> vrtn(new Variation());
-	auto alpha = -Score::Infinite();
-	auto beta = Score::Infinite();
-	max_depth = 2; // estimation stage
-	auto est = QSearchEitherColour(position_, alpha, beta, vrtn);
-	max_depth = max_depth_;
-	QSearchEitherColour(position_, est, est + 25, vrtn);
+	/// Search one ply deeper each iteration, so that there is always a
+	/// move from the last completed iteration to play when stopped. 
+	/// Each iteration is searched first with a window around the score
+	/// of the one before, re-searching with a wider window if the score 
+	/// falls outside of it.
+	auto start = std::chrono::steady_clock::now();
+	limits = limits_;
+	limit_reached = false;
+	nodes = 0;
+	pruned = PruningCounters();
+	nmp_min_ply = 0;
+	history->Clear();
+	seldepth = 0;
+	principal_variation = std::make_shared<Variation>();
 
-	// Need to clear the position history, used for 3 move repetition.
-	PositionHistory::Clear();
-	return vrtn;
+	/// The first ordering of the root moves is that of the move selector,
+	/// after that they are ordered by the previous iteration.
+	root_moves.clear();
+	MoveSelector msel(position_, position_history, 0, nullptr, nullptr, true);
+	while (Move mv = msel.Next())
+		root_moves.push_back({ mv, -Score::Infinite() });
+	if (root_moves.empty())
+		return principal_variation;
+	best_move_info.best_move = root_moves[0].move;
+
+	Score previous;
+	for (int depth = 1; depth <= limits.depth; depth++)
+	{
+		int delta = aspiration_window;
+		auto alpha = -Score::Infinite();
+		auto beta = Score::Infinite();
+		if (depth > 1 && !previous.IsMate())
+		{
+			alpha = previous - delta;
+			beta = previous + delta;
+		}
+
+		Score score;
+		std::shared_ptr<Variation> vrtn;
+		while (true)
+		{
+			vrtn = std::make_shared<Variation>();
+			score = SearchRootMoves(position_, alpha, beta, depth, vrtn);
+			if (Stopped())
+				break;
+
+			/// Widen on the side it failed, opening that side fully once
+			/// the window is wide. A mate score opens the window fully
+			/// as well, there is no meaningful margin around it.
+			if (score <= alpha && alpha != -Score::Infinite())
+			{
+				delta *= 2;
+				alpha = (delta > max_aspiration_window || score.IsMate())
+					? -Score::Infinite() : score - delta;
+			}
+			else if (score >= beta && beta != Score::Infinite())
+			{
+				delta *= 2;
+				beta = (delta > max_aspiration_window || score.IsMate())
+					? Score::Infinite() : score + delta;
+			}
+			else
+				break;
+		}
+
+		/// An unfinished iteration can not be trusted, so the result of
+		/// the last one to finish stands.
+		if (Stopped())
+			break;
+
+		previous = score;
+		principal_variation = vrtn;
+		best_move_info.best_move = vrtn->move;
+		best_move_info.score = score;
+		best_move_info.depth = depth;
+		SendInfo(depth, score, start);
+
+		if (limits.soft_time_ms)
+		{
+			auto elapsed = std::chrono::steady_clock::now() - limits.start;
+			if (std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() >= limits.soft_time_ms)
+				break;
+		}
+	}
+	return principal_variation;
 }
 
-Score Search::QSearchEitherColour(
-	Position& position_,
+Score Search::SearchRootMoves(
+	Position &position,
 	Score alpha,
 	Score beta,
+	int depth,
 	std::shared_ptr<Variation> vrtn)
 {
-	/// Every level of the search is a maximizer of the score,
-	/// which means that the logic is essentially that of scoring
-	/// in favour of the white pieces. So negate the search root 
-	/// node for the black pieces if they are the root.
-	Score score;
-	if (position_.ToMove().IsBlack()) {
-		score = QSearch(position_, -beta, -alpha, vrtn, 0);
-	}
-	else {
-		score = QSearch(position_, alpha, beta, vrtn, 0);
+	/// Search the root moves in order, then sort them so the best ones 
+	/// are searched first in the next iteration. The moves which failed
+	/// low keep their order since their scores are all the bound.
+	for (auto& rm : root_moves)
+		rm.score = -Score::Infinite();
+
+	bool first = true;
+	for (auto& rm : root_moves)
+	{
+		position.Apply(rm.move, position_history);
+		std::shared_ptr<Variation> vrtnMore(new Variation());
+		Score score;
+		if (first)
+			score = -PVSearch(position, -beta, -alpha, depth - 1, vrtnMore, 1, true);
+		else
+		{
+			score = -PVSearch(position, -(alpha + 1), -alpha, depth - 1, vrtnMore, 1, false);
+			if (score > alpha && score < beta)
+				score = -PVSearch(position, -beta, -alpha, depth - 1, vrtnMore, 1, true);
+		}
+		position.Unapply(rm.move, position_history);
+		if (Stopped())
+			return alpha;
+		first = false;
+
+		rm.score = score;
+		if (score > alpha)
+		{
+			alpha = score;
+			Join(vrtn, vrtnMore, rm.move);
+		}
+		if (alpha >= beta)
+			break;
 	}
-	return score;
+
+	std::stable_sort(root_moves.begin(), root_moves.end(),
+		[](const RootMove& a, const RootMove& b) { return a.score > b.score; });
+	return alpha >= beta ? beta : alpha;
+}
+
+void Search::SendInfo(int depth, Score score, std::chrono::steady_clock::time_point start)
+{
+	/// Report a completed iteration.
+	if (!info_callback)
+		return;
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	int time_ms = int(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+	int nps = int((1000 * nodes) / (time_ms + 1));
+
+	PvInfo info;
+	info.pv = principal_variation;
+	info.score = score;
+	info.depth = depth;
+	info.seldepth = seldepth;
+	info.time = info.time_ms = time_ms;
+	info.nodes = info.nodes_searched = int(nodes);
+	info.nps = info.nodes_per_second = nps;
+	info.tb_hits = 0;
+	info.multipv = 1;
+	info.is_black = false;
+	info.hashfull = tt ? tt->Hashfull() : -1;
+	info_callback({ info });
 }
 
-Score Evaluate(Position &position, int dfr)
+int StaticEval(Position &position)
 {
 	/// Take the centipawn positional evaluation and
 	/// negate it if it's blacks turn because the score
@@ -87,30 +266,341 @@ Score Evaluate(Position &position, int dfr)
 	auto cp = Evaluation::StaticScore(position);
 	if (position.ToMove().IsBlack())
 		cp *= -1;
-	auto stateval = Score::Centipawns(cp, dfr);
-	
-	/// If there are no legal moves it is either checkmate
-	/// or it is stalemate. Since we are the maximizer right now
-	/// and in checkmate, it will seem as though we are in 
-	/// checkmate position from black pieces, so always have
-	/// checkmate in -dfr.
-	if (!position.AnyLegalMove())
-	{
-		if (position.IsInCheck())
-			stateval = -Score::Checkmate(dfr); 
+	return cp;
+}
+
+bool IsDrawByRule(const Position &position, const PositionHistory& history)
+{
+	/// The fifty move rule (the counter is in plies) and three move
+	/// repetition end the game whatever the position.
+	return position.GetFiftyCounter() >= 100
+		|| history.HaveBeenThreeRepetitions(position.Key(), position.GetFiftyCounter());
+}
+
+bool HasPieces(const Position &position)
+{
+	/// Anything other than pawns and the king, for the side to move.
+	auto us = position.ToMove();
+	auto pawns_king = position.PieceBoard(us, PAWN) | position.PieceBoard(us, KING);
+	return bool(position.Occupants(us) & ~pawns_king);
+}
+
+bool IsQuiet(const Position &position, Move move)
+{
+	return !position.MoveIsCapture(move) && SpecialMoveType(move) != PROMOTE;
+}
+
+// Moves remembered at a node, to be penalised if another causes a cutoff.
+// Any beyond this are too late in the ordering to matter.
+static const int max_moves_tried = 64;
+
+void Search::UpdateHistories(
+	const Position &position,
+	Move best,
+	const Move* quiets,
+	int quiet_count,
+	const Move* captures,
+	int capture_count,
+	int depth,
+	int dfr)
+{
+	/// The move which caused a cutoff is rewarded, and the moves of the
+	/// same kind searched before it without one are penalised by as much
+	/// so they are ordered after it next time. A quiet move also becomes
+	/// a killer and the countermove. Captures searched first are 
+	/// penalised even when a quiet move was best.
+	int bonus = HistoryBonus(depth);
+	if (IsQuiet(position, best))
+	{
+		history->UpdateQuiet(position, position_history, best, bonus);
+		for (int i = 0; i < quiet_count; i++)
+			history->UpdateQuiet(position, position_history, quiets[i], -bonus);
+		history->AddKiller(dfr, best);
+	}
+	else
+		history->UpdateCapture(position, best, bonus);
+
+	for (int i = 0; i < capture_count; i++)
+		history->UpdateCapture(position, captures[i], -bonus);
+}
+
+// Plies taken off the search of a late quiet move, by depth and by how
+// many moves came before it. Moves ordered late rarely turn out best, so
+// they are searched shallower first and only in full if they surprise.
+static int reductions[64][64];
+
+// Quiet moves searched at the shallowest depths before the rest are
+// skipped altogether.
+static const int late_move_counts[4] = { 0, 4, 7, 12 };
+
+// Ordering score worth a ply less (or more) of reduction.
+static const int reduction_history_scale = 16384;
+
+void InitSearch()
+{
+	for (int depth = 1; depth < 64; depth++)
+		for (int moves = 1; moves < 64; moves++)
+			reductions[depth][moves] = int(0.75 + std::log(depth) * std::log(moves) / 2.25);
+}
+
+// Depths left at which margin based pruning is tried.
+static const int reverse_futility_depth = 6;
+static const int futility_depth = 6;
+static const int razor_depth = 3;
+
+// Depth left at which moves losing material by exchange are skipped,
+// and how much they may lose per ply left.
+static const int see_depth = 6;
+static const int see_margin = 80;
+
+// The least a move may win by exchange and still be searched in the main
+// search, the plies left may make up for some loss.
+static int SeeThreshold(int depth)
+{
+	return -see_margin * depth;
+}
+
+// What a capture in quiescence must be able to gain beyond the piece it
+// takes, for positional compensation, to be worth searching.
+static const int delta_margin = 200;
+
+// Null move searches are checked by a search of the real moves at this
+// depth and beyond, where being in zugzwang costs the most, unless the
+// NullMoveVerify option is off.
+static const int null_verify_depth = 10;
+
+Score Search::PVSearch(
+	Position &position,
+	Score alpha,
+	Score beta,
+	int depth,
+	std::shared_ptr<Variation> vrtn,
+	int dfr,
+	bool pv_node)
+{
+	/// The full width search, to the given depth. Only the first move 
+	/// of a principal variation node is searched with the full window, 
+	/// the rest are expected to fail low which is quicker to show with 
+	/// a zero window. Any which does not is searched again in full.
+	if (depth <= 0)
+		return QSearch(position, alpha, beta, vrtn, dfr, 0);
+
+	CountNode();
+	if (dfr > seldepth)
+		seldepth = dfr;
+	if (Stopped())
+		return alpha;
+	if (IsDrawByRule(position, position_history))
+		return Score::Centipawns(0, dfr);
+	if (dfr >= max_ply)
+		return Score::Centipawns(StaticEval(position), dfr);
+
+	auto key = position.Key();
+	auto alpha_in = alpha;
+
+	/// A result stored from a search at least as deep settles the node
+	/// when its bound puts it outside the window. Scores inside the window
+	/// are searched again, which keeps the principal variation whole.
+	TTData tte;
+	bool tt_hit = tt && tt->Probe(key, &tte);
+	if (tt_hit && tte.depth >= depth)
+	{
+		auto tt_score = ScoreFromTT(tte.score, dfr);
+		if (tte.bound != BOUND_UPPER && tt_score >= beta)
+			return beta;
+		if (tte.bound != BOUND_LOWER && tt_score <= alpha)
+			return alpha;
+	}
+	int static_eval = tt_hit ? tte.eval : StaticEval(position);
+	bool in_check = position.IsInCheck();
+	auto eval_score = Score::Centipawns(static_eval, dfr);
+
+	/// Near the leaves a static evaluation far outside the window is 
+	/// unlikely to be brought back inside by the few plies left.
+	bool prunable = !pv_node && !in_check && !alpha.IsMate() && !beta.IsMate();
+
+	/// Reverse futility (static null move) pruning. So far above beta 
+	/// that the opponent can not be expected to recover, cut off.
+	if (prunable
+		&& depth <= reverse_futility_depth
+		&& eval_score - options.reverse_futility_margin * depth >= beta)
+	{
+		pruned.reverse_futility++;
+		return beta;
+	}
+
+	/// Razoring. So far below alpha that only winning material could help,
+	/// so ask quiescence and give up if it can not raise alpha either.
+	if (prunable
+		&& depth <= razor_depth
+		&& eval_score + options.razor_margin * depth < alpha)
+	{
+		auto score = QSearch(position, alpha, beta, vrtn, dfr, 0);
+		if (Stopped())
+			return alpha;
+		if (score <= alpha)
+		{
+			pruned.razoring++;
+			return alpha;
+		}
+	}
+
+	/// Futility pruning, below alpha by more than a quiet move can be 
+	/// expected to gain so only the captures and promotions are searched.
+	bool futile = prunable
+		&& depth <= futility_depth
+		&& eval_score + options.futility_margin * depth <= alpha;
+
+	/// Null move pruning. If the opponent were given a free move and still
+	/// could not bring the score below beta, then a real move would not
+	/// either, so a reduced search after passing is enough to cut off. 
+	/// It is wrong in zugzwang, where passing is better than any move, so
+	/// not in check, not with only pawns, not twice in a row and, at high
+	/// depth, only if a search of the real moves agrees.
+	if (options.null_move
+		&& !pv_node
+		&& dfr >= nmp_min_ply
+		&& depth >= 2
+		&& !position_history.LastWasNull()
+		&& !in_check
+		&& HasPieces(position)
+		&& eval_score >= beta)
+	{
+		int reduction = 3 + depth / 6;
+		position.ApplyNull(position_history);
+		std::shared_ptr<Variation> vrtnNull(new Variation());
+		auto null_score = -PVSearch(position, -beta, -(beta - 1), depth - 1 - reduction, vrtnNull, dfr + 1, false);
+		position.UnapplyNull(position_history);
+		if (Stopped())
+			return alpha;
+
+		if (null_score >= beta)
+		{
+			if (!options.null_move_verify || nmp_min_ply || depth < null_verify_depth)
+				return beta;
+			nmp_min_ply = dfr + 3 * (depth - reduction) / 4;
+			std::shared_ptr<Variation> vrtnVerify(new Variation());
+			auto score = PVSearch(position, beta - 1, beta, depth - reduction, vrtnVerify, dfr, false);
+			nmp_min_ply = 0;
+			if (score >= beta)
+				return beta;
+		}
+	}
+
+	MoveSelector msel(position, position_history, tt_hit ? tte.move : 0, history->killers[dfr], history.get(), true);
+	Move best_move = 0;
+	int move_count = 0;
+	Move quiets_tried[max_moves_tried];
+	Move captures_tried[max_moves_tried];
+	int quiet_count = 0;
+	int capture_count = 0;
+	int quiets_searched = 0;
+	while (Move mv = msel.Next())
+	{
+		move_count++;
+		bool quiet = msel.Stage() == QUIETS;
+		bool is_quiet = IsQuiet(position, mv);
+
+		/// Late move pruning. Near the leaves, once enough quiet moves have
+		/// failed to raise alpha the rest are very unlikely to either.
+		/// Checks are still searched.
+		if (quiet
+			&& !pv_node
+			&& !in_check
+			&& depth < 4
+			&& quiets_searched >= late_move_counts[depth]
+			&& !position.GivesCheck(mv))
+		{
+			pruned.late_move++;
+			continue;
+		}
+
+		/// A checking move is kept, its worth is not in the material.
+		if (quiet && futile && move_count > 1 && !position.GivesCheck(mv))
+		{
+			pruned.futility++;
+			continue;
+		}
+
+		/// Near the leaves skip quiet moves and captures which give away
+		/// more material by exchange than the depth left could make up.
+		/// Good captures have already been found not to lose material.
+		auto stage = msel.Stage();
+		if (prunable
+			&& move_count > 1
+			&& depth <= see_depth
+			&& (stage == QUIETS || stage == BAD_CAPTURES)
+			&& SEE(position, mv) < SeeThreshold(depth))
+		{
+			pruned.see++;
+			continue;
+		}
+
+		if (quiet)
+			quiets_searched++;
+		position.Apply(mv, position_history);
+		std::shared_ptr<Variation> vrtnMore(new Variation());
+		int new_depth = depth - 1;
+		Score score;
+		if (move_count == 1)
+			score = -PVSearch(position, -beta, -alpha, new_depth, vrtnMore, dfr + 1, pv_node);
 		else
-			stateval = Score::Centipawns(0, dfr);
+		{
+			/// Late move reductions, less for principal variation nodes,
+			/// checks and moves which have done well before. A reduced
+			/// search which beats alpha is done again to full depth.
+			int reduction = 0;
+			if (quiet && depth >= 3 && move_count > (pv_node ? 2 : 1))
+			{
+				reduction = reductions[std::min(depth, 63)][std::min(move_count, 63)];
+				if (pv_node)
+					reduction--;
+				if (in_check || position.IsInCheck())
+					reduction--;
+				reduction -= msel.MoveScore() / reduction_history_scale;
+				reduction = std::max(0, std::min(reduction, new_depth - 1));
+			}
+
+			score = -PVSearch(position, -(alpha + 1), -alpha, new_depth - reduction, vrtnMore, dfr + 1, false);
+			if (reduction > 0 && score > alpha)
+				score = -PVSearch(position, -(alpha + 1), -alpha, new_depth, vrtnMore, dfr + 1, false);
+			if (pv_node && score > alpha && score < beta)
+				score = -PVSearch(position, -beta, -alpha, new_depth, vrtnMore, dfr + 1, true);
+		}
+		position.Unapply(mv, position_history);
+		if (Stopped())
+			return alpha;
+
+		if (score > alpha)
+		{
+			alpha = score;
+			best_move = mv;
+			Join(vrtn, vrtnMore, mv);
+		}
+		if (alpha >= beta)
+		{
+			UpdateHistories(position, mv, quiets_tried, quiet_count, captures_tried, capture_count, depth, dfr);
+			if (tt)
+				tt->Store(key, mv, ScoreToTT(beta, dfr), int16_t(static_eval), depth, BOUND_LOWER);
+			return beta;
+		}
+		if (is_quiet && quiet_count < max_moves_tried)
+			quiets_tried[quiet_count++] = mv;
+		else if (!is_quiet && capture_count < max_moves_tried)
+			captures_tried[capture_count++] = mv;
 	}
 
-	/// Include the 50 move rule and three move repetition here
-	/// as it is done at the beginning of every node and will 
-	/// accordingly update alpha.
-	//	TOOD: This does not currently work actually,
-	//	three repetition is defective.
-	if (position.GetFiftyCounter() >= 50 || position.ThreeMoveRepetition())
-		stateval = Score::Centipawns(0, dfr);
+	/// No legal moves is checkmate or stalemate, checkmate in dfr plies 
+	/// from the root as seen by the side which is mated.
+	if (move_count == 0)
+		return in_check ? -Score::Checkmate(dfr) : Score::Centipawns(0, dfr);
 
-	return stateval;
+	if (tt)
+	{
+		auto bound = alpha > alpha_in ? BOUND_EXACT : BOUND_UPPER;
+		tt->Store(key, best_move, ScoreToTT(alpha, dfr), int16_t(static_eval), depth, bound);
+	}
+	return alpha;
 }
 
 Score Search::QSearch(
@@ -118,55 +608,93 @@ Score Search::QSearch(
 	Score alpha, 
 	Score beta, 
 	std::shared_ptr<Variation> vrtn, 
-	int dfr)
+	int dfr,
+	int depth)
 {
+	/// Search only the moves which change the material (and evasions
+	/// from check) until the position is quiet, so that the static 
+	/// evaluation is not taken in the middle of an exchange. On the 
+	/// first ply (depth 0) the quiet moves which give check are tried too.
+	CountNode();
+	if (dfr > seldepth)
+		seldepth = dfr;
+	if (Stopped())
+		return alpha;
+	if (IsDrawByRule(position, position_history))
+		return Score::Centipawns(0, dfr);
+
+	/// Deeper than the first ply is all the same to the table.
+	int tt_depth = std::max(depth, -1);
+	auto key = position.Key();
+	auto alpha_in = alpha;
+
+	TTData tte;
+	bool tt_hit = tt && tt->Probe(key, &tte);
+	if (tt_hit && tte.depth >= tt_depth)
+	{
+		auto tt_score = ScoreFromTT(tte.score, dfr);
+		if (tte.bound != BOUND_UPPER && tt_score >= beta)
+			return beta;
+		if (tte.bound != BOUND_LOWER && tt_score <= alpha)
+			return alpha;
+	}
+
 	/// Take the current score of the position for standing pat. We do not 
 	/// take pieces unfavourably. The score is cp, if this is greater than
 	/// beta then the move which has just been applied gives us greater  
 	/// than what we know we can have, thefore opponent will not play it. 
 	/// If the cp is greater than alpha then we increase the minimum which 
-	/// can be expected.
-	if (dfr > 0)
+	/// can be expected. In check there is no standing pat, every evasion
+	/// is searched.
+	bool in_check = position.IsInCheck();
+	int static_eval = tt_hit ? tte.eval : StaticEval(position);
+	if (!in_check)
 	{
-		auto spat = Evaluate(position, dfr);
+		auto spat = Score::Centipawns(static_eval, dfr);
 		if (spat >= beta)
-			return spat;
+			return beta;
 		if (alpha < spat)
 			alpha = spat;
 	}
 
-	/// If the current alpha is checkmate then it must have 
-	/// been updated by the static evaluation of the position 
-	/// used for standing pat and to detect draws or checkmates. 
-	/// So here we return alpha. Current context is checkmated, 
-	/// it gets negated to the parent maximizer.
-	if (alpha.IsMate())
-		return alpha;
-
-	/// Iterate through moves which are included in 
-	/// qsearch. This will be evades from checks, checks 
-	/// themselves and captures, think about including types 
-	/// of attacks too.
+	MoveSelector msel(position, position_history, tt_hit ? tte.move : 0, nullptr, nullptr, false, depth == 0);
+	Move best_move = 0;
+	int move_count = 0;
+	while (Move mv = msel.Next())
+	{
+		move_count++;
+		if (!in_check)
+		{
+			/// The selector gives the captures which lose material by
+			/// exchange (SEE below 0) last. With no depth left to win the
+			/// material back, quiescence skips all of them.
+			if (msel.Stage() == BAD_CAPTURES)
+			{
+				pruned.see++;
+				continue;
+			}
 
-	/*
-	// Not yet implemented, just use the move selector for now.
-	auto moveIterator = position.MoveIterator( CAPTURES | EVADES | CHECKS ); 
-	// Not yet implemented, use move selector.
-	for (auto move = moveIterator.begin(); move != moveIterator.end(); ++move)
-	*/
+			/// Delta pruning, even taking the piece for nothing would
+			/// leave the score below alpha.
+			if (position.MoveIsCapture(mv)
+				&& SpecialMoveType(mv) != PROMOTE
+				&& Score::Centipawns(static_eval + Victim(position, mv) + delta_margin, dfr) <= alpha)
+			{
+				pruned.delta++;
+				continue;
+			}
+		}
 
-	MoveSelector msel(position, dfr <= max_depth);
-	auto mvs = msel.GetMoves();	
-	for(auto mv : mvs)
-	{
 		/// Apply the move and then search all of the the new position
 		/// but this time maximize for the opposition. Do this by 
 		/// swapping the alpha to negative beta, beta to negative alpha 
 		/// and negating the whole result.
-		position.Apply(mv.second);
+		position.Apply(mv, position_history);
 		std::shared_ptr<Variation> vrtnMore(new Variation());
-		auto score = -QSearch( position, -beta, -alpha, vrtnMore, dfr+1);
-		position.Unapply(mv.second);
+		auto score = -QSearch(position, -beta, -alpha, vrtnMore, dfr + 1, depth - 1);
+		position.Unapply(mv, position_history);
+		if (Stopped())
+			return alpha;
 
 		/// Update alpha. If alpha is never updated we will get a fail-low situation.
 		/// Fail-low: A fail-low indicates that this position was not good enough for us. 
@@ -176,7 +704,8 @@ Score Search::QSearch(
 		if (score > alpha)
 		{
 			alpha = score;
-			Join(vrtn, vrtnMore, mv.second);
+			best_move = mv;
+			Join(vrtn, vrtnMore, mv);
 		}
 
 		/// A fail - high indicates that the search found something that was
@@ -185,18 +714,24 @@ Score Search::QSearch(
 		/// that they'll do this. If they can avoid this position, there is no longer
 		/// any need to search successors, since this position won't happen.
 		if (alpha >= beta)
+		{
+			if (tt)
+				tt->Store(key, mv, ScoreToTT(beta, dfr), int16_t(static_eval), tt_depth, BOUND_LOWER);
 			return beta;
-		
+		}
 	}
 
-	// At root update the best move found of the child nodes.
-	if (dfr == 0)
+	/// Every evasion is generated in check, so having none is mate.
+	if (in_check && move_count == 0)
+		return -Score::Checkmate(dfr);
+
+	/// Only a move raising alpha makes the score exact. Standing pat is a
+	/// floor under the score, which a pruned capture might have beaten.
+	if (tt)
 	{
-		//Mutex::Lock lock(counters_mutex);
-		best_move_info.best_move = vrtn->move;
-		best_move_info.score = alpha;
+		auto bound = best_move ? BOUND_EXACT : alpha > alpha_in ? BOUND_LOWER : BOUND_UPPER;
+		tt->Store(key, best_move, ScoreToTT(alpha, dfr), int16_t(static_eval), tt_depth, bound);
 	}
-
 	return alpha;
 }
 
@@ -1,38 +1,125 @@
 #ifndef position_searcher_h
 #define position_searcher_h
 
+#include <atomic>
+#include <chrono>
+
 #include "position.h"
 #include "move.h"
 #include "utils.h"
 #include "evaluation.h"
+#include "movehistory.h"
+#include "transposition.h"
 
 namespace Medusa 
 {
+	// Leaf counts of a perft run.
+	struct PerftInfo
+	{
+		// Count under each root move, when dividing.
+		std::vector<std::pair<Move, size_t>> divide;
+		size_t nodes = 0;
+		int64_t time_ms = 0;
+	};
+
+	// Settings of the search which can be changed through UCI options.
+	struct SearchOptions
+	{
+		bool null_move = true;
+		// Check null move cutoffs at high depth with a search of the real
+		// moves.
+		bool null_move_verify = true;
+
+		// Centipawns per ply of depth left, for pruning near the leaves.
+		int reverse_futility_margin = 80;
+		int futility_margin = 100;
+		int razor_margin = 250;
+	};
+
+	// Nodes (or for futility, moves) each pruning technique cut off.
+	struct PruningCounters
+	{
+		size_t reverse_futility = 0;
+		size_t futility = 0;
+		size_t razoring = 0;
+		size_t see = 0;
+		size_t delta = 0;
+		size_t late_move = 0;
+	};
+
+	// A move at the root with its score from the last iteration which
+	// searched it, the root moves are ordered by these.
+	struct RootMove
+	{
+		Move move;
+		Score score;
+	};
+
+	// When the search stops deepening. Only the depth limit is always set,
+	// the rest are 0 for no limit. A search stopped part way through an
+	// iteration plays the best move of the last one completed.
+	struct SearchLimits
+	{
+		int depth = max_ply - 1;
+		size_t nodes = 0;
+		// Milliseconds from the start. No iteration is started after the
+		// soft limit, since it would be unlikely to finish, and the search
+		// is stopped at the hard limit.
+		int64_t soft_time_ms = 0;
+		int64_t hard_time_ms = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		// The best move is held back until stopped, as for go infinite.
+		bool infinite = false;
+	};
+
+	// Fill the search tables, must be called once on start up.
+	void InitSearch();
+
 	class Search
 	{
 	public:
+		Score PVSearch(
+			Position &position,
+			Score alpha,
+			Score beta,
+			int depth,
+			std::shared_ptr<Variation> vrtn,
+			int dfr,
+			bool pv_node);
+
 		Score QSearch(
 			Position &position,
 			Score alpha,
 			Score beta,
 			std::shared_ptr<Variation> vrtn,
-			int dfr);
+			int dfr,
+			int depth = 0);
 
-		Score QSearchEitherColour(
-			Position& position_,
+		Score SearchRootMoves(
+			Position &position,
 			Score alpha,
 			Score beta,
+			int depth,
 			std::shared_ptr<Variation> vrtn);
 
 		std::shared_ptr<Variation> IterWindowSearch(
 			Position &position_,
-			int max_depth_
+			const SearchLimits& limits_
 		);
 
-		std::shared_ptr<Variation> SearchRoot(Position &pos, int max_depth);
+		// Search from the position reached by the moves in the history,
+		// which are looked back over for repetitions.
+		std::shared_ptr<Variation> SearchRoot(
+			Position &pos,
+			const PositionHistory& history,
+			const SearchLimits& limits);
+
+		static size_t Perft(Position &position, PositionHistory& history, size_t depth);
+		static PerftInfo Divide(Position &position, size_t depth, bool divide);
 		//void Start(const Position &pos, int max_depth);
 		
-		size_t GetNodesSearched() const { return 0; }
+		size_t GetNodesSearched() const { return nodes; }
+		const PruningCounters& GetPruningCounters() const { return pruned; }
 
 		BestMoveInfo GetBestMoveInfo() const {
 			return best_move_info;
@@ -42,15 +129,58 @@ namespace Medusa
 			info_callback = info_callback_;
 		}
 
-		static void SetSearchingFlag(bool value) {
-			Search::searching_flag = value;
+		void SetOptions(const SearchOptions& options_) {
+			options = options_;
+		}
+
+		// Shared with any other searches, or none.
+		void SetTranspositionTable(TranspositionTable* tt_) {
+			tt = tt_;
+		}
+
+		// The search gives up when the flag is set, leaving the result of
+		// the last completed iteration.
+		void SetStopFlag(const std::atomic<bool>* stop_flag_) {
+			stop_flag = stop_flag_;
 		}
 
 	private:
-		static size_t Perft(Position &position, size_t depth);
-		static bool searching_flag;
+		bool Stopped() const {
+			return limit_reached || (stop_flag && stop_flag->load(std::memory_order_relaxed));
+		}
+
+		// Count a node and see whether the node or time limit is reached.
+		void CountNode();
+
+		void SendInfo(int depth, Score score, std::chrono::steady_clock::time_point start);
+
+		void UpdateHistories(
+			const Position &position,
+			Move best,
+			const Move* quiets,
+			int quiet_count,
+			const Move* captures,
+			int capture_count,
+			int depth,
+			int dfr);
+
+		const std::atomic<bool>* stop_flag = nullptr;
+		SearchLimits limits;
+		bool limit_reached = false;
+		TranspositionTable* tt = nullptr;
+		SearchOptions options;
+		// While a null move cut off is verified, null move is not tried
+		// again until this ply, so the verification sees the real moves
+		// near its root.
+		int nmp_min_ply = 0;
 		std::shared_ptr<Variation> principal_variation;
-		int max_depth;
+		std::vector<RootMove> root_moves;
+		int seldepth = 0;
+		size_t nodes = 0;
+		PruningCounters pruned;
+		std::unique_ptr<MoveHistory> history{ new MoveHistory() };
+		// The game moves and then the moves of the search down to the node.
+		PositionHistory position_history;
 		BestMoveInfo best_move_info;
 		PvInfo::Callback info_callback;
 	};
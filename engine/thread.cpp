@@ -5,17 +5,31 @@ namespace Medusa
 {
 	void Thread::StartThread(
 		Position &pos,
-		int max_depth,
+		const PositionHistory& history,
+		const SearchLimits& limits,
+		TranspositionTable* tt,
+		const SearchOptions& options,
 		BestMoveInfo::Callback bestmovecallback,
 		PvInfo::Callback infocallback)
 	{
-		Search search;
-		search.SetSearchingFlag(true);
-		search.SetInfoCallback(infocallback);
-		auto searching_lambda = [&search, pos, max_depth, bestmovecallback]
+		// The thread owns its search and its copies of the position and of
+		// the game history, for spotting repetitions. Stopping the thread
+		// stops the search. An infinite search which runs out of depth
+		// waits to be stopped before giving its move.
+		auto searching_lambda = [this, pos, history, limits, tt, options, bestmovecallback, infocallback]
 		{
+			Search search;
+			search.SetStopFlag(&stop_);
+			search.SetTranspositionTable(tt);
+			search.SetOptions(options);
+			search.SetInfoCallback(infocallback);
 			auto cpos = pos;
-			search.SearchRoot(cpos, max_depth);
+			search.SearchRoot(cpos, history, limits);
+			if (limits.infinite)
+			{
+				Mutex::Lock lock(counters_mutex);
+				watchdog_cv.wait(lock.get_raw(), [this] { return !IsSearchActive(); });
+			}
 			bestmovecallback(search.GetBestMoveInfo());
 		};
 		threads.emplace_back(searching_lambda);
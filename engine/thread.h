@@ -14,6 +14,8 @@
 #include <thread>
 
 #include "position.h"
+#include "search.h"
+#include "transposition.h"
 #include "utils/mutex.h"
 
 namespace Medusa
@@ -58,7 +60,10 @@ namespace Medusa
 
 		void StartThread(
 			Position &pos,
-			int max_depth,
+			const PositionHistory& history,
+			const SearchLimits& limits,
+			TranspositionTable* tt,
+			const SearchOptions& options,
 			BestMoveInfo::Callback bestcallback,
 			PvInfo::Callback infocallback);
 
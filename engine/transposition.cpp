@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <new>
+
+#include "transposition.h"
+
+namespace Medusa
+{
+	static const int mate_value = 32000;
+	static const int max_centipawns = 30000;
+
+	int16_t ScoreToTT(const Score& score, int dfr)
+	{
+		if (!score.IsMate())
+		{
+			int cp = int(score.GetCentipawns());
+			return int16_t(std::max(-max_centipawns, std::min(max_centipawns, cp)));
+		}
+		int plies = score.GetMatePlies();
+		int from_node = std::abs(plies) - dfr;
+		return int16_t(plies > 0 ? mate_value - from_node : -(mate_value - from_node));
+	}
+
+	Score ScoreFromTT(int16_t value, int dfr)
+	{
+		if (std::abs(value) <= max_centipawns)
+			return Score::Centipawns(value, dfr);
+		auto mate = Score::Checkmate(mate_value - std::abs(value) + dfr);
+		return value > 0 ? mate : -mate;
+	}
+
+	// The data word, from the low bits: depth (offset so quiescence 
+	// depths are positive), bound, generation, eval, score, move.
+	static uint64_t Pack(Move move, int16_t score, int16_t eval, int depth, Bound bound, uint8_t generation)
+	{
+		return uint64_t(uint8_t(depth + 16))
+			| (uint64_t(bound) << 8)
+			| (uint64_t(generation) << 10)
+			| (uint64_t(uint16_t(eval)) << 16)
+			| (uint64_t(uint16_t(score)) << 32)
+			| (uint64_t(move) << 48);
+	}
+
+	static int DepthOf(uint64_t data) { return int(data & 0xff) - 16; }
+	static uint8_t GenerationOf(uint64_t data) { return uint8_t((data >> 10) & 0x3f); }
+
+	TranspositionTable::TranspositionTable(size_t megabytes)
+	{
+		Resize(megabytes);
+	}
+
+	void TranspositionTable::Resize(size_t megabytes)
+	{
+		size_t count = 1;
+		while (2 * count * sizeof(Bucket) <= megabytes * 1024 * 1024)
+			count *= 2;
+
+		// Over allocate so the buckets can start on a cache line.
+		memory.reset(new char[count * sizeof(Bucket) + alignof(Bucket)]);
+		auto address = reinterpret_cast<uintptr_t>(memory.get());
+		address = (address + alignof(Bucket) - 1) & ~uintptr_t(alignof(Bucket) - 1);
+		buckets = reinterpret_cast<Bucket*>(address);
+		for (size_t i = 0; i < count; i++)
+			new (&buckets[i]) Bucket();
+		mask = count - 1;
+		Clear();
+	}
+
+	void TranspositionTable::Clear()
+	{
+		for (size_t i = 0; i <= mask; i++)
+		{
+			for (auto& entry : buckets[i].entries)
+			{
+				entry.check.store(0, std::memory_order_relaxed);
+				entry.data.store(0, std::memory_order_relaxed);
+			}
+		}
+		generation = 0;
+	}
+
+	bool TranspositionTable::Probe(uint64_t key, TTData* tte) const
+	{
+		for (auto& entry : BucketOf(key).entries)
+		{
+			uint64_t data = entry.data.load(std::memory_order_relaxed);
+			if ((entry.check.load(std::memory_order_relaxed) ^ data) != key || !data)
+				continue;
+			tte->move = Move(data >> 48);
+			tte->score = int16_t(data >> 32);
+			tte->eval = int16_t(data >> 16);
+			tte->depth = DepthOf(data);
+			tte->bound = Bound((data >> 8) & 3);
+			return true;
+		}
+		return false;
+	}
+
+	// Replace the entry of the same position if there is one, unless it 
+	// is from this search and deeper and the new result is only a bound.
+	// Otherwise replace the one least worth keeping: the shallowest, 
+	// counting each search it has been left behind for as a ply less.
+	void TranspositionTable::Store(uint64_t key, Move move, int16_t score, int16_t eval, int depth, Bound bound)
+	{
+		auto& bucket = BucketOf(key);
+		Entry* replace = nullptr;
+		int worst = 0;
+		for (auto& entry : bucket.entries)
+		{
+			uint64_t data = entry.data.load(std::memory_order_relaxed);
+			if ((entry.check.load(std::memory_order_relaxed) ^ data) == key)
+			{
+				if (bound != BOUND_EXACT
+					&& GenerationOf(data) == generation
+					&& DepthOf(data) > depth)
+					return;
+
+				// Keep the move of a result without one.
+				if (!move)
+					move = Move(data >> 48);
+				replace = &entry;
+				break;
+			}
+			int age = (generation - GenerationOf(data)) & generation_mask;
+			int worth = data ? DepthOf(data) - 8 * age : -1000;
+			if (!replace || worth < worst)
+			{
+				replace = &entry;
+				worst = worth;
+			}
+		}
+
+		uint64_t data = Pack(move, score, eval, depth, bound, generation);
+		replace->check.store(key ^ data, std::memory_order_relaxed);
+		replace->data.store(data, std::memory_order_relaxed);
+	}
+
+	int TranspositionTable::Hashfull() const
+	{
+		int used = 0;
+		size_t samples = std::min<size_t>(1000 / bucket_entries, mask + 1);
+		for (size_t i = 0; i < samples; i++)
+		{
+			for (auto& entry : buckets[i].entries)
+			{
+				uint64_t data = entry.data.load(std::memory_order_relaxed);
+				used += data && GenerationOf(data) == generation;
+			}
+		}
+		return int(1000 * used / (samples * bucket_entries));
+	}
+};
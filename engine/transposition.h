@@ -0,0 +1,84 @@
+#ifndef transposition_h
+#define transposition_h
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+#include "types.h"
+
+namespace Medusa
+{
+	// What a stored score says about the true score.
+	enum Bound : uint8_t
+	{
+		BOUND_NONE = 0,
+		BOUND_UPPER = 1,
+		BOUND_LOWER = 2,
+		BOUND_EXACT = 3,
+	};
+
+	// A probed entry, unpacked.
+	struct TTData
+	{
+		Move move;
+		int16_t score;
+		int16_t eval;
+		int depth;
+		Bound bound;
+	};
+
+	// Scores are stored in 16 bits, mates as the distance from the node
+	// they were stored at rather than from the root, so that they are 
+	// right wherever the position is reached.
+	int16_t ScoreToTT(const Score& score, int dfr);
+	Score ScoreFromTT(int16_t value, int dfr);
+
+	// Results of earlier searches keyed by position, shared by all of the
+	// search threads. The entries of a bucket share a cache line. Each 
+	// entry is two words, the data and the key XOR the data, so neither 
+	// locks nor torn reads are a problem; a torn entry does not verify.
+	class TranspositionTable
+	{
+	public:
+		explicit TranspositionTable(size_t megabytes = 16);
+
+		// Resizing clears the table, it must not be used while resizing.
+		void Resize(size_t megabytes);
+		void Clear();
+
+		// Called at the start of each search so older entries can be told
+		// apart and replaced first.
+		void NewSearch() { generation = (generation + 1) & generation_mask; }
+
+		bool Probe(uint64_t key, TTData* data) const;
+		void Store(uint64_t key, Move move, int16_t score, int16_t eval, int depth, Bound bound);
+
+		// Entries from this search per thousand, sampled.
+		int Hashfull() const;
+
+	private:
+		static const int bucket_entries = 4;
+		static const uint8_t generation_mask = 0x3f;
+
+		struct Entry
+		{
+			std::atomic<uint64_t> check;
+			std::atomic<uint64_t> data;
+		};
+
+		struct alignas(64) Bucket
+		{
+			Entry entries[bucket_entries];
+		};
+
+		Bucket& BucketOf(uint64_t key) const { return buckets[key & mask]; }
+
+		std::unique_ptr<char[]> memory;
+		Bucket* buckets = nullptr;
+		size_t mask = 0;
+		uint8_t generation = 0;
+	};
+};
+
+#endif
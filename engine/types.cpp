@@ -138,6 +138,11 @@ namespace Medusa
 		return mate_in / 2 + 1;
 	}
 
+	// Plies from the root to the mate, negative when being mated.
+	int Score::GetMatePlies() const {
+		return mate_in;
+	}
+
 	double Score::GetCentipawns() const {
 		return centipawns_for;
 	}
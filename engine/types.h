@@ -54,6 +54,7 @@ namespace Medusa
 		bool operator<=(const Score& rhs) const;
 		bool IsMate() const;
 		int GetMateIn() const;
+		int GetMatePlies() const;
 		double GetCentipawns() const;
 		int GetDepth() const;
 		Score operator-() const;
@@ -85,6 +86,7 @@ namespace Medusa
 		int nps;
 		int tb_hits;
 		int multipv;
+		int hashfull = -1;
 
 		using Callback = std::function<void(const std::vector<PvInfo>&)>;
 	};
@@ -1,8 +1,11 @@
 #include "uci.h"
+#include "attacks.h"
+#include "perft.h"
 #include "types.h"
 #include "utils.h"
 #include "utils/logging.h"
 
+#include <algorithm>
 #include <exception>
 #include <functional>
 #include <iomanip>
@@ -44,11 +47,77 @@ namespace Medusa {
 		}
 	}
 
+	// The value of a spin option, which must be within its bounds.
+	int GetSpin(const std::string& value, int min, int max) {
+		int number;
+		try {
+			number = std::stoi(value);
+		}
+		catch (std::exception&) {
+			throw Exception("invalid value " + value);
+		}
+		if (number < min || number > max)
+			throw Exception("invalid value " + value);
+		return number;
+	}
+
+	// The value of a check option.
+	bool GetCheck(const std::string& value) {
+		if (StringsEqualIgnoreCase(value, "true"))
+			return true;
+		if (StringsEqualIgnoreCase(value, "false"))
+			return false;
+		throw Exception("invalid value " + value);
+	}
+
 	bool ContainsKey(const std::unordered_map<std::string, std::string>& params,
 		const std::string& key) {
 		return params.find(key) != params.end();
 	}
 
+	// Time kept back from every move for passing it to the GUI.
+	const int64_t move_overhead_ms = 50;
+
+	// Moves the game is guessed to go on for when there is no movestogo.
+	const int expected_moves_left = 30;
+
+	// When to stop the search, from the go parameters. On the clock the 
+	// time for a move is the time left shared over the moves expected to
+	// be left, plus the increment. No iteration is started after half of
+	// that, and one is cut short at twice that or when the time is nearly
+	// gone. Infinite and ponder searches are only stopped by depth, nodes
+	// or stop.
+	SearchLimits GetSearchLimits(const GoParams& params, Colour us,
+		std::chrono::steady_clock::time_point start) {
+		SearchLimits limits;
+		limits.start = start;
+		if (params.depth)
+			limits.depth = std::max(1, std::min(*params.depth, max_ply - 1));
+		if (params.nodes)
+			limits.nodes = size_t(std::max(1, *params.nodes));
+		limits.infinite = params.infinite || params.ponder;
+		if (limits.infinite)
+			return limits;
+
+		if (params.movetime)
+		{
+			limits.hard_time_ms = std::max<int64_t>(1, *params.movetime - move_overhead_ms);
+			return limits;
+		}
+
+		auto time = us.IsWhite() ? params.wtime : params.btime;
+		if (time)
+		{
+			auto increment = (us.IsWhite() ? params.winc : params.binc).value_or(0);
+			int moves_left = std::max(1, params.movestogo.value_or(expected_moves_left));
+			auto available = std::max<int64_t>(1, *time - move_overhead_ms);
+			auto budget = std::min(available, *time / moves_left + increment);
+			limits.soft_time_ms = std::max<int64_t>(1, budget / 2);
+			limits.hard_time_ms = std::min(available, 2 * budget);
+		}
+		return limits;
+	}
+
 	std::pair<std::string, std::unordered_map<std::string, std::string>>
 		ParseCommand(const std::string& line) {
 		std::unordered_map<std::string, std::string> params;
@@ -126,7 +195,8 @@ namespace Medusa {
 
 	void UciLoop::SendBestMove(const BestMoveInfo& move)
 	{
-		std::string res = "bestmove " + AsUci(move.best_move);
+		// With no legal move to play the protocol wants the null move.
+		std::string res = "bestmove " + (move.best_move ? AsUci(move.best_move) : std::string("0000"));
 		SendResponse(res);
 	}
 
@@ -136,6 +206,7 @@ namespace Medusa {
 		for (const auto& info : infos) {
 			std::string res = "info";
 			if (info.depth >= 0) res += " depth " + std::to_string(info.depth);
+			if (info.seldepth >= 0) res += " seldepth " + std::to_string(info.seldepth);
 			if (info.time >= 0) res += " time " + std::to_string(info.time);
 			if (info.nodes >= 0) res += " nodes " + std::to_string(info.nodes);
 			
@@ -143,6 +214,7 @@ namespace Medusa {
 				res += " score cp " + std::to_string(int(info.score.GetCentipawns()));
 			else
 				res += " score mate " + std::to_string(info.score.GetMateIn());
+			if (info.hashfull >= 0) res += " hashfull " + std::to_string(info.hashfull);
 			if (info.nps >= 0) res += " nps " + std::to_string(info.nps);
 
 			res += " pv " + GetLine(info.pv);
@@ -158,9 +230,17 @@ namespace Medusa {
 
 	void UciLoop::CmdUci()
 	{
+		SendId();
+		SendResponses(kKnownOptions);
 		SendResponse("uciok");
 	}
 
+	void UciLoop::CmdSetOption(const std::string& name,
+		const std::string& value)
+	{
+		engine_.SetOption(name, value);
+	}
+
 	void UciLoop::CmdIsReady()
 	{
 		engine_.EnsureReady();
@@ -185,6 +265,21 @@ namespace Medusa {
 		engine_.Go(params);
 	}
 
+	void UciLoop::CmdPerft(int depth, bool divide)
+	{
+		auto info = engine_.Perft(depth, divide);
+		std::vector<std::string> reses;
+		for (const auto& move_nodes : info.divide)
+			reses.push_back(AsUci(move_nodes.first) + ": " + std::to_string(move_nodes.second));
+
+		auto nps = (1000 * info.nodes) / (info.time_ms + 1);
+		reses.push_back("info depth " + std::to_string(depth) +
+			" nodes " + std::to_string(info.nodes) +
+			" time " + std::to_string(info.time_ms) +
+			" nps " + std::to_string(nps));
+		SendResponses(reses);
+	}
+
 	void UciLoop::CmdStop()
 	{
 		engine_.Stop();
@@ -202,6 +297,10 @@ namespace Medusa {
 		{
 			CmdIsReady();
 		}
+		else if (command == "setoption")
+		{
+			CmdSetOption(GetOrEmpty(params, "name"), GetOrEmpty(params, "value"));
+		}
 		else if (command == "ucinewgame")
 		{
 			CmdUciNewGame();
@@ -250,9 +349,16 @@ namespace Medusa {
 			UCIGOOPTION(depth);
 			UCIGOOPTION(nodes);
 			UCIGOOPTION(movetime);
+			UCIGOOPTION(perft);
+			UCIGOOPTION(divide);
 
 #undef UCIGOOPTION
-			CmdGo(go_params);
+			if (go_params.divide)
+				CmdPerft(*go_params.divide, true);
+			else if (go_params.perft)
+				CmdPerft(*go_params.perft, false);
+			else
+				CmdGo(go_params);
 		}
 		else if (command == "stop")
 		{
@@ -304,6 +410,7 @@ namespace Medusa {
 		move_start_time_ = std::chrono::steady_clock::now();
 		SharedLock lock(busy_mutex_);
 		thread_.reset();
+		tt_.Clear();
 		time_spared_ms_ = 0;
 		current_position_.reset();
 	}
@@ -324,12 +431,6 @@ namespace Medusa {
 	void EngineController::Go(const GoParams& params)
 	{
 		auto start_time = move_start_time_;
-		
-		// Given wtime, btime, winc, binc manage the time. Simple model for this
-		// is to estimate the number of moves left in the game, then expected total
-		// time is expected_moves * [w/b]inc + [w/b]time and time per move should be
-		// that divided by expected_moves. If time ever goes below 20 seconds then we
-		// should use [w/b]inc. 
 		go_params_ = params;
 
 		PvInfo::Callback info(info_callback_);
@@ -342,15 +443,34 @@ namespace Medusa {
 		else
 			SetupPosition(Medusa::start_pos_fen, {});
 
+		auto limits = GetSearchLimits(go_params_, current_position_instance_.ToMove(), start_time);
 		thread_ = std::make_unique<Thread>();
+		tt_.NewSearch();
 
 		thread_->StartThread(
 			current_position_instance_,
-			go_params_.depth.value_or(2),
+			current_position_history_,
+			limits,
+			&tt_,
+			search_options_,
 			bestmove,
 			info);
 	}
 
+	// Blocks.
+	PerftInfo EngineController::Perft(int depth, bool divide)
+	{
+		if (current_position_)
+			SetupPosition(current_position_->fen, current_position_->moves);
+		else
+			SetupPosition(Medusa::start_pos_fen, {});
+
+		if (depth < 0)
+			throw Exception("perft depth must not be negative");
+		auto position = current_position_instance_;
+		return ParallelPerft(position, depth, divide, perft_threads_, perft_hash_mb_);
+	}
+
 	// Must not block.
 	void EngineController::Stop()
 	{
@@ -358,6 +478,37 @@ namespace Medusa {
 			thread_->Stop();
 	}
 
+	// Blocks.
+	void EngineController::SetOption(const std::string& name, 
+		const std::string& value)
+	{
+		std::unique_lock<RpSharedMutex> lock(busy_mutex_);
+		if (StringsEqualIgnoreCase(name, "Hash"))
+		{
+			// No search may be using the table while it is replaced.
+			thread_.reset();
+			tt_.Resize(GetSpin(value, 1, 4096));
+		}
+		else if (StringsEqualIgnoreCase(name, "NullMove"))
+			search_options_.null_move = GetCheck(value);
+		else if (StringsEqualIgnoreCase(name, "NullMoveVerify"))
+			search_options_.null_move_verify = GetCheck(value);
+		else if (StringsEqualIgnoreCase(name, "ReverseFutilityMargin"))
+			search_options_.reverse_futility_margin = GetSpin(value, 0, 1000);
+		else if (StringsEqualIgnoreCase(name, "FutilityMargin"))
+			search_options_.futility_margin = GetSpin(value, 0, 1000);
+		else if (StringsEqualIgnoreCase(name, "RazorMargin"))
+			search_options_.razor_margin = GetSpin(value, 0, 1000);
+		else if (StringsEqualIgnoreCase(name, "PerftThreads"))
+			perft_threads_ = GetSpin(value, 1, 64);
+		else if (StringsEqualIgnoreCase(name, "PerftHash"))
+			perft_hash_mb_ = GetSpin(value, 0, 4096);
+		else
+		{
+			throw Exception("Unknown option: " + name);
+		}
+	}
+
 	// Set up position.
 	void EngineController::SetupPosition(const std::string& fen,
 		const std::vector<std::string>& moves_str)
@@ -366,9 +517,10 @@ namespace Medusa {
 		thread_.reset();
 		
 		current_position_instance_ = PositionFromFen(fen);
+		current_position_history_.Clear();
 		std::vector<Move> moves;
 		for (const auto& move : moves_str) 
-			current_position_instance_.ApplyUCI(move);
+			current_position_instance_.ApplyUCI(move, current_position_history_);
 
 #ifdef _DEBUG
 		current_position_instance_.PrettyPrint();
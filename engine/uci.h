@@ -11,6 +11,7 @@
 #include <shared_mutex>
 #include <optional>
 
+#include "search.h"
 #include "thread.h"
 #include "utils.h"
 #include "utils/mutex.h"
@@ -29,13 +30,25 @@ namespace Medusa {
 				{{"position"}, {"fen", "startpos", "moves"}},
 				{{"go"},
 				 {"infinite", "wtime", "btime", "winc", "binc", "movestogo", "depth",
-				  "nodes", "movetime", "searchmoves", "ponder"}},
+				  "nodes", "movetime", "searchmoves", "ponder", "perft", "divide"}},
 				{{"start"}, {}},
 				{{"stop"}, {}},
 				{{"ponderhit"}, {}},
 				{{"quit"}, {}},
 				{{"xyzzy"}, {}},
 		};
+
+		// Known options, sent in response to uci.
+		const std::vector<std::string> kKnownOptions = {
+			"option name Hash type spin default 16 min 1 max 4096",
+			"option name NullMove type check default true",
+			"option name NullMoveVerify type check default true",
+			"option name ReverseFutilityMargin type spin default 80 min 0 max 1000",
+			"option name FutilityMargin type spin default 100 min 0 max 1000",
+			"option name RazorMargin type spin default 250 min 0 max 1000",
+			"option name PerftThreads type spin default 1 min 1 max 64",
+			"option name PerftHash type spin default 16 min 0 max 4096",
+		};
 	}
 
 	// Go parameters
@@ -48,6 +61,9 @@ namespace Medusa {
 		optional<int> depth;
 		optional<int> nodes;
 		optional<std::int64_t> movetime;
+		// Count leaf nodes instead of searching, divide per root move.
+		optional<int> perft;
+		optional<int> divide;
 		bool infinite = false;
 		std::vector<std::string> searchmoves;
 		bool ponder = false;
@@ -81,6 +97,10 @@ namespace Medusa {
 		void Go(const GoParams& params);
 		// Must not block.
 		void Stop();
+		// Blocks.
+		PerftInfo Perft(int depth, bool divide);
+		// Blocks.
+		void SetOption(const std::string& name, const std::string& value);
 
 	private:
 		void SetupPosition(const std::string& fen,
@@ -94,9 +114,15 @@ namespace Medusa {
 		using SharedLock = std::shared_lock<RpSharedMutex>;
 		std::unique_ptr<Thread> thread_;
 		Position current_position_instance_;
+		// The moves played to reach it.
+		PositionHistory current_position_history_;
 		optional<CurrentPosition> current_position_;
 		GoParams go_params_;
 		int64_t time_spared_ms_ = 0;
+		TranspositionTable tt_;
+		SearchOptions search_options_;
+		int perft_threads_ = 1;
+		size_t perft_hash_mb_ = 16;
 		std::chrono::steady_clock::time_point move_start_time_;
 	};
 	
@@ -119,12 +145,12 @@ namespace Medusa {
 		void CmdUci();
 		void CmdIsReady();
 		void CmdSetOption(const std::string&,
-			const std::string&,
 			const std::string&);
 		void CmdUciNewGame();
 		void CmdPosition(const std::string&,
 			const std::vector<std::string>&);
 		void CmdGo(const GoParams&);
+		void CmdPerft(int depth, bool divide);
 		void CmdStop();
 
 	private:
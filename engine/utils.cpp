@@ -124,9 +124,11 @@ namespace Medusa
 		auto colour = Colour::FromString(colour_string);
 		pos.set_colour(colour);
 
-		if (epstring != "-")
+		// As after a double push, the square is dropped when no pawn can
+		// take on it.
+		auto epboard = epstring != "-" ? BitboardFromString(epstring) : Bitboard(0);
+		if (epboard && (PawnAttacks(~colour, BbSqr(epboard)) & pos.PieceBoard(colour, PAWN)))
 		{
-			auto epboard = BitboardFromString(epstring);
 			pos.SetEnPassant(epboard);
 		}
 		else
@@ -242,7 +244,7 @@ namespace Medusa
 	}
 
 	// Apply UCI move to the position.
-	void Position::ApplyUCI(std::string move_str)
+	void Position::ApplyUCI(std::string move_str, PositionHistory& history)
 	{
 		auto moves = LegalMoves<Any>();
 
@@ -251,7 +253,7 @@ namespace Medusa
 			auto this_move_str = AsUci(m);
 			if (this_move_str == move_str)
 			{
-				Apply(m);
+				Apply(m, history);
 				return;
 			}
 		}
@@ -363,19 +365,19 @@ namespace Medusa
 		return result;
 	}
 
-	void Apply(Position &pos, std::shared_ptr<Variation> md)
+	void Apply(Position &pos, PositionHistory& history, std::shared_ptr<Variation> md)
 	{
 		std::shared_ptr<Variation> tmp = md;
 
 		// Go forward.
 		while (tmp->after != nullptr)
 		{
-			pos.Apply(tmp->move);
+			pos.Apply(tmp->move, history);
 			tmp = tmp->after;
 		}
 	}
 
-	void Unapply(Position &pos, std::shared_ptr<Variation> md)
+	void Unapply(Position &pos, PositionHistory& history, std::shared_ptr<Variation> md)
 	{
 		std::shared_ptr<Variation> tmp = End(md);
 
@@ -383,7 +385,7 @@ namespace Medusa
 		while (tmp->before != nullptr)
 		{
 			tmp = tmp->before;
-			pos.Unapply(tmp->move);
+			pos.Unapply(tmp->move, history);
 		};
 	}
 
@@ -79,10 +79,10 @@ namespace Medusa
 	};
 
 	// Apply moves
-	void Apply(Position &pos, std::shared_ptr<Variation> md);
+	void Apply(Position &pos, PositionHistory& history, std::shared_ptr<Variation> md);
 
 	// Unapply moves
-	void Unapply(Position &pos, std::shared_ptr<Variation> md);
+	void Unapply(Position &pos, PositionHistory& history, std::shared_ptr<Variation> md);
 
 	// Get line
 	std::string GetLine(std::shared_ptr<Variation> md);
@@ -0,0 +1,41 @@
+#include "zobrist.h"
+
+namespace Medusa
+{
+	namespace Zobrist
+	{
+		uint64_t pieces[2][NUMBER_PIECES][64];
+		uint64_t castling[16];
+		uint64_t enpassant[8];
+		uint64_t black_to_move;
+	}
+
+	// SplitMix64, seeded the same every time so the keys (and anything 
+	// keyed by them) do not change between runs.
+	static uint64_t NextKey(uint64_t& state)
+	{
+		uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	void InitZobrist()
+	{
+		uint64_t state = 0x4D65647573610000ULL;
+		for (int c = 0; c < 2; c++)
+			for (int p = 0; p < NUMBER_PIECES; p++)
+				for (int sqr = 0; sqr < 64; sqr++)
+					Zobrist::pieces[c][p][sqr] = NextKey(state);
+
+		// No rights at all is left as zero, so an empty board has no key.
+		Zobrist::castling[0] = 0;
+		for (int i = 1; i < 16; i++)
+			Zobrist::castling[i] = NextKey(state);
+
+		for (int file = 0; file < 8; file++)
+			Zobrist::enpassant[file] = NextKey(state);
+
+		Zobrist::black_to_move = NextKey(state);
+	}
+};
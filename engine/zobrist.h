@@ -0,0 +1,27 @@
+#ifndef zobrist_h
+#define zobrist_h
+
+#include <stdint.h>
+
+#include "board.h"
+
+namespace Medusa
+{
+	// Random keys for hashing positions. The key of a position is the XOR
+	// of the keys of each piece on its square, the castling rights, the 
+	// file of the en passant square and black to move. Each of those is 
+	// toggled in and out as the position changes.
+	namespace Zobrist
+	{
+		extern uint64_t pieces[2][NUMBER_PIECES][64];
+		extern uint64_t castling[16];
+		extern uint64_t enpassant[8];
+		extern uint64_t black_to_move;
+	}
+
+	// Fill the keys, must be called once on start up before any position
+	// is made.
+	void InitZobrist();
+};
+
+#endif